@@ -0,0 +1,55 @@
+/**
+ * @file affinity.cpp
+ */
+
+#include "affinity.hpp"
+
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+std::vector<int> available_cpus() {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+  }
+#endif
+  if (cpus.empty()) {
+    const int count = std::thread::hardware_concurrency();
+    for (int cpu = 0; cpu < count; ++cpu) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+bool pin_current_thread(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
+
+bool set_current_thread_idle() {
+#ifdef __linux__
+  sched_param param{};
+  if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) == 0)
+    return true;
+  // Fall back to the lowest nice level. On Linux, nice is per thread.
+  return setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19) == 0;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,24 @@
+/**
+ * @file affinity.hpp
+ *
+ * CPU placement and scheduling priority of threads.
+ */
+
+#ifndef _affinity_hpp
+#define _affinity_hpp
+
+#include <vector>
+
+/// CPUs the process is allowed to run on, in increasing order
+std::vector<int> available_cpus();
+
+/// Pin the calling thread to a single CPU. Returns false if not supported.
+bool pin_current_thread(int cpu);
+
+/**
+ * Lower the scheduling priority of the calling thread so it only uses
+ * otherwise idle CPU time. Returns false if not supported.
+ */
+bool set_current_thread_idle();
+
+#endif  // _affinity_hpp
@@ -7,11 +7,17 @@
  */
 
 #include "application.hpp"
+#include "bookmark.hpp"
+#include "nucleus.hpp"
 #include "render.hpp"
 #include "strop.hpp"
+#include "trace.hpp"
 
-#include <sstream>
+#include <array>
 #include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 
 /// On screen pixel format
 static SDL_PixelFormatEnum pixel_format = SDL_PIXELFORMAT_ARGB8888;
@@ -19,6 +25,12 @@ static SDL_PixelFormatEnum pixel_format = SDL_PIXELFORMAT_ARGB8888;
 /// Zoom in/out factor
 static const float zoom_factor = 0.9;
 
+/**
+ * Display frame interval. Renders are restarted and the screen is updated at
+ * most once per frame, while the workers keep rendering in between.
+ */
+static const auto frame_interval = std::chrono::milliseconds(16);
+
 /// Rendering starting time
 static std::chrono::time_point<std::chrono::high_resolution_clock> start;
 
@@ -32,8 +44,8 @@ void mandelbrot_application::recreate_render_texture() {
   render_reconfigure(width, height);
 }
 
-mandelbrot_application::mandelbrot_application() 
-  : font(nullptr) {
+mandelbrot_application::mandelbrot_application(const render_options &options)
+    : font(nullptr), options(options) {
   SDL_Init(SDL_INIT_VIDEO);
 
   TTF_Init();
@@ -47,7 +59,8 @@ mandelbrot_application::mandelbrot_application()
 
   pixel_format = (SDL_PixelFormatEnum)SDL_GetWindowPixelFormat(window);
 
-  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+  renderer = SDL_CreateRenderer(
+      window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 
   recreate_render_texture();
 }
@@ -72,8 +85,12 @@ void mandelbrot_application::render_text(int x, int y, const char *str) {
 static const char *help[] = {
     "h, ?, F1: toggle help display",
     "i: toggle information display",
+    "a: cycle anti-aliasing (none, distance estimated, adaptive)",
+    "p: toggle interior prediction",
     "shift+<N>: use fixed precision",
     "shift+0: use dynamic precision (default)",
+    "<N>: load bookmark, ctrl+<N>: save bookmark",
+    "n: zoom to the minibrot near the mouse",
 };
 
 void mandelbrot_application::render_help() {
@@ -86,6 +103,19 @@ void mandelbrot_application::render_help() {
   }
 }
 
+/**
+ * Post a row completion from a render worker to the event loop. The render
+ * generation is passed in user.data1.
+ */
+static void push_row_complete_event(int row, unsigned int generation) {
+  SDL_Event event;
+  memset(&event, 0, sizeof(event));
+  event.type = ROWRENDER_COMPLETE_EVENT;
+  event.user.code = row;
+  event.user.data1 = reinterpret_cast<void *>(uintptr_t(generation));
+  SDL_PushEvent(&event);
+}
+
 void mandelbrot_application::run() {
   bool keep_running = true;
   bool show_help = false;
@@ -94,55 +124,100 @@ void mandelbrot_application::run() {
   std::array<int, 32> rows_completed;
   unsigned int rows_completed_count = 0;
 
-  render_init();
+  if (!options.trace_file.empty()) trace_start(1 << 16);
+  trace_thread_name("main");
+
+  options.row_complete = push_row_complete_event;
+  render_init(options);
+
+  std::ofstream stats_file;
+  if (!options.stats_file.empty())
+    stats_file.open(options.stats_file, std::ios::app);
 
   bool update_surface = false;
   bool restart_render = true;
 
+  auto next_frame = std::chrono::steady_clock::now();
   bool wait = true;
   while (keep_running) {
     SDL_Event e;
 
     // Use polling until event queue is empty, then re-render if needed and
-    // wait.
-    if (wait) {
+    // wait. Until the next frame is due, rows completed and input such as
+    // zooming by the mouse wheel are gathered, and handled in one go.
+    const auto now = std::chrono::steady_clock::now();
+    if (wait && (restart_render || update_surface) && now < next_frame) {
+      const auto timeout =
+          std::chrono::duration_cast<std::chrono::milliseconds>(next_frame -
+                                                                now);
+      if (!SDL_WaitEventTimeout(&e, int(timeout.count()) + 1)) continue;
+      wait = false;
+    } else if (wait) {
+      if (restart_render || update_surface) next_frame = now + frame_interval;
       if (restart_render) {
         cancel_render();
         start_render();
         start = std::chrono::high_resolution_clock::now();
         restart_render = false;
+        // Show the previous frame, reprojected to the new view
+        rows_completed_count = rows_completed.max_size();
+        update_surface = true;
       }
 
       if (update_surface) {
-        /* TODO: Only copy rendered rows */
+        auto upload_start = trace_clock::now();
         int texture_pitch;
         void *pix = NULL;
         SDL_LockTexture(texture, NULL, &pix, &texture_pitch);
         int width, h;
         SDL_GetWindowSize(window, &width, &h);
         if (rows_completed_count == rows_completed.max_size()) {
-          render_copy_pixels(pix, 0, width * h * 4);
+          render_copy_front(pix, 0, width * h * 4);
         } else {
           for (unsigned int i = 0; i < rows_completed_count; ++i) {
             int row = rows_completed[i];
             int pixels_pitch = width * 4;
-            render_copy_pixels((uint8_t *)pix + texture_pitch * row,
-                   pixels_pitch * row, width * 4);
+            render_copy_front((uint8_t *)pix + texture_pitch * row,
+                              pixels_pitch * row, width * 4);
           }
         }
         rows_completed_count = 0;
         SDL_UnlockTexture(texture);
+        trace_complete("texture update", upload_start);
         SDL_RenderCopy(renderer, texture, NULL, NULL);
 
         if (show_information) {
-          render_text(10, 10, render_get_float_type_name());
+          RENDER_TEXT(10, 10, render_get_float_type_name()
+                                  << ", " << render_get_antialias_name());
           RENDER_TEXT(10, 30, pixel_size);
           RENDER_TEXT(10, 50, jobs_remaining);
+          auto stats = render_get_stats();
+          double busy_ms = 0.0;
+          for (const auto &thread : stats.threads) busy_ms += thread.busy_ms;
+          RENDER_TEXT(10, 70,
+                      "iterations: " << stats.iterations << " ("
+                                     << stats.iterations / stats.elapsed_ms /
+                                            1000.0
+                                     << " M/s)");
+          RENDER_TEXT(10, 90,
+                      "escaped: " << stats.escaped << ", interior: "
+                                  << stats.interior << " (" << stats.predicted
+                                  << " predicted), supersampled: "
+                                  << stats.supersampled);
+          RENDER_TEXT(10, 110,
+                      "busy: " << int(100.0 * busy_ms /
+                                      (stats.elapsed_ms * stats.threads.size()))
+                               << "%, queue wait: " << stats.queue_wait_ms
+                               << " ms, cancel: " << stats.cancel_latency_ms
+                               << " ms");
         }
 
         if (show_help) render_help();
 
-        SDL_RenderPresent(renderer);
+        {
+          trace_span span("present");
+          SDL_RenderPresent(renderer);
+        }
         update_surface = false;
       }
       SDL_WaitEvent(&e);
@@ -156,15 +231,18 @@ void mandelbrot_application::run() {
 
     switch (e.type) {
       case ROWRENDER_COMPLETE_EVENT:
+        if (uintptr_t(e.user.data1) != render_generation()) break;
         if (--jobs_remaining == 0) {
           auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
                               std::chrono::high_resolution_clock::now() - start)
                               .count();
           std::cout << "render complete in " << duration << " ms" << std::endl;
+          if (stats_file) write_json(stats_file, render_get_stats());
         }
         {
           int row = e.user.code;
           if (row < rows) {
+            render_present_row(row);
             if (rows_completed_count < rows_completed.max_size())
               rows_completed[rows_completed_count++] = e.user.code;
             update_surface = true;
@@ -188,6 +266,17 @@ void mandelbrot_application::run() {
         } else if (e.key.keysym.sym == SDLK_i) {
           show_information = !show_information;
           update_surface = true;
+        } else if (e.key.keysym.sym == SDLK_a) {
+          antialias = Antialias((antialias + 1) % AA_MAX);
+          std::cout << render_get_antialias_name() << std::endl;
+          restart_render = true;
+        } else if (e.key.keysym.sym == SDLK_p) {
+          predict_interior = !predict_interior;
+          std::cout << "interior prediction "
+                    << (predict_interior ? "on" : "off") << std::endl;
+          restart_render = true;
+        } else if (e.key.keysym.sym == SDLK_n) {
+          if (zoom_to_minibrot()) restart_render = true;
         } else if (e.key.keysym.sym == SDLK_RIGHT) {
           center_x += screen_size * flt(0.1);
           std::cout << center_x << std::endl;
@@ -228,19 +317,34 @@ void mandelbrot_application::run() {
         } else if (e.key.keysym.mod == KMOD_LCTRL ||
                    e.key.keysym.mod == KMOD_RCTRL) {
           if (e.key.keysym.sym >= SDLK_0 && e.key.keysym.sym <= SDLK_9) {
-            // int num = e.key.keysym.sym - SDLK_0;
-            // save(num);
+            const int slot = e.key.keysym.sym - SDLK_0;
+            if (save_bookmark(bookmark_file, slot,
+                              {center_x, center_y, screen_size})) {
+              std::cout << "saved bookmark " << slot << std::endl;
+            } else {
+              std::cerr << "failed to save bookmark " << slot << std::endl;
+            }
           }
         } else if (e.key.keysym.mod == KMOD_NONE) {
           if (e.key.keysym.sym >= SDLK_0 && e.key.keysym.sym <= SDLK_9) {
-            // int num = e.key.keysym.sym - SDLK_0;
-            // std::cout << "loading slot" << num << std::endl;
-            // // load(num);
-            // restart_render = true;
+            const int slot = e.key.keysym.sym - SDLK_0;
+            view_position pos;
+            if (load_bookmark(bookmark_file, slot, pos)) {
+              cancel_render();
+              center_x = pos.center_x;
+              center_y = pos.center_y;
+              screen_size = pos.size;
+              std::cout << position_to_text(pos) << std::endl;
+              restart_render = true;
+            } else {
+              std::cout << "no bookmark " << slot << std::endl;
+            }
           }
         }
         break;
       case SDL_MOUSEMOTION:
+        // Render the rows around the mouse pointer first
+        render_set_focus(e.motion.y);
         break;
       case SDL_MOUSEWHEEL: {
         cancel_render();
@@ -256,12 +360,15 @@ void mandelbrot_application::run() {
           restart_render = true;
           break;
         }
+        if (e.window.event == SDL_WINDOWEVENT_LEAVE) render_set_focus(-1);
+        break;
     }
   }
 
   running = false;
   cancel_render();
   render_stop();
+  if (trace_enabled) trace_write(options.trace_file);
 }
 
 void mandelbrot_application::zoom(int x, int y, float scale) {
@@ -273,35 +380,29 @@ void mandelbrot_application::zoom(int x, int y, float scale) {
   screen_size *= flt(scale);
   flt new_pixel_size = screen_size / flt(height);
 
-  flt left = center_x - width * old_pixel_size * flt(0.5);
-  flt top = center_y - height * old_pixel_size * flt(0.5);
-
+  // The point under x,y stays in place. The displayed frame is reprojected
+  // when the next render starts.
   center_x = center_x + ofsx * old_pixel_size - ofsx * new_pixel_size;
   center_y = center_y + ofsy * old_pixel_size - ofsy * new_pixel_size;
+}
 
-  flt x1 = width * flt(0.5) - (center_x - left) / new_pixel_size;
-  flt y1 = height * flt(0.5) - (center_y - top) / new_pixel_size;
-
-  // Render scaled version of on-screen texture to a temporary texture and copy
-  // pixels.
-  SDL_Texture *temp_texture = SDL_CreateTexture(
-      renderer, pixel_format, SDL_TEXTUREACCESS_TARGET, width, height);
-  SDL_SetRenderTarget(renderer, temp_texture);
-  SDL_FRect dst{static_cast<float>(x1), static_cast<float>(y1),
-                static_cast<float>(width / scale),
-                static_cast<float>(height / scale)};
-  if (scale > 1.0) SDL_RenderCopy(renderer, texture, 0, 0);
-  SDL_RenderCopyF(renderer, texture, 0, &dst);
-  SDL_RenderReadPixels(renderer, 0, pixel_format, pixels, pitch);
-  SDL_SetRenderTarget(renderer, NULL);
-  SDL_DestroyTexture(temp_texture);
-
-  // Update the on-screen texture
-  int texture_pitch;
-  void *pix = NULL;
-  SDL_LockTexture(texture, NULL, &pix, &texture_pitch);
-  memcpy(pix, pixels, width * height * 4);
-  SDL_UnlockTexture(texture);
+bool mandelbrot_application::zoom_to_minibrot() {
+  int width, height, x, y;
+  SDL_GetWindowSize(window, &width, &height);
+  SDL_GetMouseState(&x, &y);
+  const flt pixel = screen_size / flt(height);
+  const flt mouse_x = center_x + (x - width / 2) * pixel;
+  const flt mouse_y = center_y + (y - height / 2) * pixel;
+  minibrot<flt> m;
+  if (!find_minibrot(mouse_x, mouse_y, screen_size / flt(8), 0, m)) {
+    std::cout << "no minibrot near the mouse" << std::endl;
+    return false;
+  }
+  cancel_render();
+  frame_minibrot(m, center_x, center_y, screen_size);
+  std::cout << "minibrot of period " << m.period << ", size "
+            << get_double(minibrot_size(m)) << std::endl;
+  return true;
 }
 
 mandelbrot_application::~mandelbrot_application() {
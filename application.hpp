@@ -4,11 +4,14 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
+#include "render.hpp"
+
 #define ROWRENDER_COMPLETE_EVENT SDL_USEREVENT
 
 class mandelbrot_application {
  public:
-  mandelbrot_application();
+  explicit mandelbrot_application(
+      const render_options &options = render_options());
   ~mandelbrot_application();
   mandelbrot_application(const mandelbrot_application &) = delete;
   mandelbrot_application &operator=(const mandelbrot_application &) = delete;
@@ -23,12 +26,18 @@ class mandelbrot_application {
   void render_text(int x, int y, const char *str);
   /** Render help text */
   void render_help();
+  /**
+   * Frame the minibrot of the lowest period near the mouse. Returns false
+   * if there is none.
+   */
+  bool zoom_to_minibrot();
 
  private:
   SDL_Window *window = nullptr;
   SDL_Renderer *renderer = nullptr;
   SDL_Texture *texture = nullptr;
   TTF_Font *font;
+  render_options options;
 };
 
 #endif // _application_hpp
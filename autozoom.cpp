@@ -0,0 +1,115 @@
+/**
+ * @file autozoom.cpp
+ *
+ * Navigation to minibrots without rendering. Finds the nucleus of the
+ * minibrot near a point, and prints the view framing it in the text form of
+ * bookmark.hpp, or stores it as a bookmark to be loaded in the explorer.
+ *
+ *     mandelbrot-autozoom [--period P] [--save N] X Y RADIUS
+ *     mandelbrot-autozoom [--period P] [--save N] --from N
+ *
+ * Without --period, the minibrot of the lowest period within RADIUS of X,Y
+ * is found. --from N searches around the center of bookmark N, within an
+ * eighth of its size. P is from 1 to max_minibrot_period.
+ */
+
+#include <cctype>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "bookmark.hpp"
+#include "float.hpp"
+#include "nucleus.hpp"
+#include "strop.hpp"
+
+/// Options from the command line
+struct autozoom_options {
+  flt x{0};
+  flt y{0};
+  flt radius{0};
+  unsigned int period = 0;
+  int save_slot = -1;
+};
+
+static int parse_slot(const std::string &arg) {
+  const int slot = std::stoi(arg);
+  if (slot < 0 || slot >= bookmark_slots)
+    throw std::runtime_error("no bookmark slot " + arg);
+  return slot;
+}
+
+static autozoom_options parse_options(int argc, char **argv) {
+  autozoom_options options;
+  int coordinates = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--period" && i + 1 < argc) {
+      // Signed, so that a negative period is rejected instead of wrapping
+      long period;
+      if (!parse_number(argv[++i], period) || period < 1 ||
+          period > long(max_minibrot_period))
+        throw std::runtime_error("period must be from 1 to " +
+                                 std::to_string(max_minibrot_period));
+      options.period = period;
+    } else if (arg == "--save" && i + 1 < argc) {
+      options.save_slot = parse_slot(argv[++i]);
+    } else if (arg == "--from" && i + 1 < argc) {
+      const int slot = parse_slot(argv[++i]);
+      view_position pos;
+      if (!load_bookmark(bookmark_file, slot, pos))
+        throw std::runtime_error("no bookmark " + std::to_string(slot));
+      options.x = pos.center_x;
+      options.y = pos.center_y;
+      options.radius = pos.size / flt(8);
+      coordinates = 3;
+    } else if (coordinates < 3 && (arg[0] != '-' || std::isdigit(arg[1]) ||
+                                   arg[1] == '.')) {
+      flt &value = coordinates == 0   ? options.x
+                   : coordinates == 1 ? options.y
+                                      : options.radius;
+      if (!parse_number(arg, value))
+        throw std::runtime_error("malformed coordinate " + arg);
+      ++coordinates;
+    } else {
+      coordinates = -1;
+      break;
+    }
+  }
+  if (coordinates != 3)
+    throw std::runtime_error(
+        "usage: " + std::string(argv[0]) +
+        " [--period P] [--save N] (X Y RADIUS | --from N)");
+  if (!(options.radius > flt(0)))
+    throw std::runtime_error("RADIUS must be positive");
+  return options;
+}
+
+int main(int argc, char **argv) {
+  try {
+    const autozoom_options options = parse_options(argc, argv);
+    minibrot<flt> m;
+    if (!find_minibrot(options.x, options.y, options.radius, options.period,
+                       m))
+      throw std::runtime_error("no minibrot found");
+    view_position pos;
+    frame_minibrot(m, pos.center_x, pos.center_y, pos.size);
+
+    std::cout << std::setprecision(std::numeric_limits<flt>::digits10)
+              << "period " << m.period << "\n"
+              << "nucleus " << m.x << " " << m.y << "\n"
+              << std::setprecision(6) << "size " << minibrot_size(m) << "\n"
+              << position_to_text(pos) << std::endl;
+    if (options.save_slot >= 0) {
+      if (!save_bookmark(bookmark_file, options.save_slot, pos))
+        throw std::runtime_error("failed to save bookmark");
+      std::cout << "saved bookmark " << options.save_slot << std::endl;
+    }
+    return EXIT_SUCCESS;
+  } catch (const std::exception &exc) {
+    std::cerr << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
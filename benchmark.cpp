@@ -1,109 +1,272 @@
+/**
+ * @file benchmark.cpp
+ *
+ * Benchmarks of the escape time kernels and of full frames rendered through
+ * the render engine, on fixed viewports.
+ *
+ * Each benchmark is run once to warm up and then repeatedly; the median and
+ * percentiles of the repetitions are reported. With --json the results are
+ * also written as JSON, for tracking regressions between builds.
+ */
+
+#include <algorithm>
+#include <cmath>
 #include <chrono>
-#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
-#if HAVE_LIBGMP
-#include <gmpxx.h>
-
-namespace std {
-mpf_class abs(mpf_class f) { return ::abs(f); }
-}  // namespace std
-
-#include "gmpfloat.hpp"
-double get_double(const mpf_class& f) { return f.get_d(); }
-#endif
-
+// The float types must be declared before mandelbrot.hpp uses std::abs
 #include "doubledouble.hpp"
+#include "floatexp.hpp"
 #include "mpfrfloat.hpp"
+
+#include "affinity.hpp"
+#include "floatdispatch.hpp"
 #include "mandelbrot.hpp"
+#include "render.hpp"
 #include "strop.hpp"
 
-static const int MIN_DURATION = 1000;
-static const int INNER_ITERATIONS = 32768;
+/// A fixed view of the set
+struct viewport {
+  const char *name;
+  const char *x;
+  const char *y;
+  const char *size;
+};
 
-template <typename FLT>
-FLT approxepsilon() {
-  FLT one{1.0};
-  FLT epsilon{1.0};
-  FLT half{0.5};
-  while (one + half * epsilon != one) {
-    epsilon = half * epsilon;
+static const viewport viewports[] = {
+    // Whole set. Mostly trivial interior caught by isinside().
+    {"shallow", "-0.6", "0", "2.0"},
+    // Seahorse valley. Mostly escaping points with high iteration counts.
+    {"boundary", "-0.7436438870371587", "0.1318259042053119", "1e-3"},
+    // Inside the period 3 bulb, not caught by isinside(), so iterates to LIMIT.
+    {"interior", "-0.1225611668766536", "0.7448617666197442", "0.05"},
+    // Deep zoom that needs more than double precision.
+    {"deep", "-0.743643887037158704752191506114774",
+     "0.131825904205311970493132056385139", "1e-20"},
+};
+
+/// Options from the command line
+struct benchmark_options {
+  int repetitions = 5;
+  std::string filter;
+  std::string json_file;
+};
+
+/// Result of a single benchmark
+struct result {
+  std::string name;
+  std::vector<double> times_ms;
+  uint64_t iterations; /**< Mandelbrot iterations per repetition */
+};
+
+static benchmark_options options;
+static std::vector<result> results;
+
+/// Percentile of sorted values, interpolated
+static double percentile(const std::vector<double> &sorted, double p) {
+  double pos = p * (sorted.size() - 1);
+  size_t i = size_t(pos);
+  if (i + 1 >= sorted.size()) return sorted.back();
+  return sorted[i] + (pos - i) * (sorted[i + 1] - sorted[i]);
+}
+
+/**
+ * Run a benchmark. fn performs one repetition and returns the number of
+ * mandelbrot iterations it did.
+ */
+static void run(const std::string &name, const std::function<uint64_t()> &fn) {
+  if (name.find(options.filter) == std::string::npos) return;
+  std::cout << std::left << std::setw(48) << name << std::flush;
+
+  result res{name, {}, fn()};  // warm up
+  for (int i = 0; i < options.repetitions; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    res.iterations = fn();
+    res.times_ms.push_back(std::chrono::duration<double, std::milli>(
+                               std::chrono::steady_clock::now() - start)
+                               .count());
   }
-  return epsilon;
+
+  std::vector<double> sorted = res.times_ms;
+  std::sort(sorted.begin(), sorted.end());
+  const double median = percentile(sorted, 0.5);
+  std::cout << std::right << std::fixed << std::setprecision(2)
+            << std::setw(10) << median << " ms" << std::setw(10)
+            << percentile(sorted, 0.1) << std::setw(10)
+            << percentile(sorted, 0.9) << std::setw(10)
+            << res.iterations / median / 1000.0 << " Mit/s" << std::endl;
+  results.push_back(res);
+}
+
+static void set_view(const viewport &v) {
+  std::istringstream(v.x) >> center_x;
+  std::istringstream(v.y) >> center_y;
+  std::istringstream(v.size) >> screen_size;
 }
 
+/// True if the type has enough precision for the viewport at this size
 template <typename FLT>
-void benchmark(const char* type) {
-  std::cout << type << ": " << std::flush;
-  int iterations = 16;
-  while (true) {
-    unsigned long sum = 0;
-    auto start = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < iterations; ++i) {
-      for (int j = 0; j < INNER_ITERATIONS; ++j) {
-        FLT xc = FLT(0.01 + (0.1 * rand() / RAND_MAX));
-        FLT yc = FLT(0.01 + (0.1 * rand() / RAND_MAX));
-        auto result = iter(xc, yc);
-        sum += result.iterations;
-      }
-    }
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-                        std::chrono::high_resolution_clock::now() - start)
-                        .count();
-    if (duration >= MIN_DURATION) {
-      long int iterations_per_millisecond =
-          iterations * INNER_ITERATIONS / duration;
-      std::cout << "\r" << sum / iterations << " - " << type << ": "
-                << iterations_per_millisecond << " iteration/msec";
-      std::cout << " " << iterations << " in " << duration << " milliseconds";
-      std::cout << ",size=" << sizeof(FLT)
-                << ",epsilon=" << std::numeric_limits<FLT>::epsilon();
-      std::cout << ",aepsilon=" << approxepsilon<FLT>();
-      std::cout << std::endl;
-      break;
-    } else if (duration <= 8) {
-      iterations *= 8;
+static bool precise_enough(const viewport &v, int height) {
+  set_view(v);
+  return double(screen_size) / height >
+         std::ldexp(1.0, 1 - int(std::numeric_limits<FLT>::digits));
+}
+
+/// Convert a coordinate to FLT through its decimal representation, as not
+/// every pair of types converts directly
+template <typename FLT>
+static FLT convert(const flt &f) {
+  std::stringstream ss;
+  ss << std::setprecision(std::numeric_limits<flt>::digits10) << f;
+  FLT result;
+  ss >> result;
+  return result;
+}
+
+/// Iterate a grid of points of a viewport with a single type
+template <typename FLT>
+static void benchmark_kernel(const char *type, const viewport &v) {
+  const int width = 32;
+  const int height = 24;
+  if (!precise_enough<FLT>(v, height)) return;
+  std::vector<FLT> xs, ys;
+  const flt size = screen_size / flt(height);
+  for (int col = 0; col < width; ++col)
+    xs.push_back(convert<FLT>(center_x + flt(col - width / 2) * size));
+  for (int row = 0; row < height; ++row)
+    ys.push_back(convert<FLT>(center_y + flt(row - height / 2) * size));
+
+  run(std::string("kernel/") + type + "/" + v.name, [&] {
+    uint64_t iterations = 0;
+    for (const FLT &y : ys)
+      for (const FLT &x : xs) iterations += iter(x, y).iterations;
+    return iterations;
+  });
+  // The same with an escape check every iteration, for comparison
+  if (escape_block<FLT>::size > 1) {
+    run(std::string("kernel/") + type + "/" + v.name + "/block:1", [&] {
+      uint64_t iterations = 0;
+      for (const FLT &y : ys)
+        for (const FLT &x : xs) iterations += iter<FLT, 1>(x, y).iterations;
+      return iterations;
+    });
+  }
+}
+
+/// Render full frames of every viewport through the render engine
+static void benchmark_frames(int threads) {
+  const int width = 160;
+  const int height = 120;
+  auto name = [&](const viewport &v) {
+    std::ostringstream os;
+    os << "frame/" << v.name << "/threads:" << threads;
+    return os.str();
+  };
+  // Don't start the engine if no frame benchmark is selected
+  if (std::none_of(std::begin(viewports), std::end(viewports),
+                   [&](const viewport &v) {
+                     return name(v).find(options.filter) != std::string::npos;
+                   }))
+    return;
+
+  render_options opts;
+  opts.threads = threads;
+  render_reconfigure(width, height);
+  render_init(opts);
+  for (const auto &v : viewports) {
+    run(name(v), [&] {
+      set_view(v);
+      start_render();
+      render_wait();
+      return render_get_stats().iterations;
+    });
+  }
+  render_stop();
+}
+
+/// Write results as JSON
+static void write_json(std::ostream &os) {
+  os << "{\"context\":{\"cpus\":" << available_cpus().size()
+     << ",\"repetitions\":" << options.repetitions << "},\"benchmarks\":[\n";
+  const char *sep = "";
+  for (const auto &res : results) {
+    std::vector<double> sorted = res.times_ms;
+    std::sort(sorted.begin(), sorted.end());
+    const double median = percentile(sorted, 0.5);
+    os << sep << "{\"name\":\"" << res.name << "\",\"iterations\":"
+       << res.iterations << ",\"median_ms\":" << median
+       << ",\"p10_ms\":" << percentile(sorted, 0.1)
+       << ",\"p90_ms\":" << percentile(sorted, 0.9)
+       << ",\"min_ms\":" << sorted.front() << ",\"max_ms\":" << sorted.back()
+       << ",\"iterations_per_second\":" << res.iterations / median * 1000.0
+       << ",\"times_ms\":[";
+    for (size_t i = 0; i < res.times_ms.size(); ++i)
+      os << (i ? "," : "") << res.times_ms[i];
+    os << "]}";
+    sep = ",\n";
+  }
+  os << "\n]}\n";
+}
+
+static void parse_options(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--repetitions" && i + 1 < argc) {
+      options.repetitions = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--filter" && i + 1 < argc) {
+      options.filter = argv[++i];
+    } else if (arg == "--json" && i + 1 < argc) {
+      options.json_file = argv[++i];
     } else {
-      iterations = (iterations * MIN_DURATION * 5 / duration) / 4;
+      throw std::runtime_error(
+          "usage: " + std::string(argv[0]) +
+          " [--repetitions N] [--filter SUBSTRING] [--json FILE]");
     }
   }
 }
 
-#define BENCHMARK(type) benchmark<type>(#type)
-
-int main(int argc, char** argv) {
-  (void)argc;
-  (void)argv;
-  srand(time(NULL));
-
-  BENCHMARK(float);
-  BENCHMARK(double);
-#if HAVE_FLOAT80
-  BENCHMARK(__float80);
-#endif
-  BENCHMARK(doubledouble<float>);
-  BENCHMARK(doubledouble<double>);
-#if HAVE_FLOAT128
-  BENCHMARK(__float128);
-#endif
-#if HAVE_LONG_DOUBLE
-  BENCHMARK(long double);
-#endif
-  BENCHMARK(doubledouble<long double>);
-  BENCHMARK(doubledouble<__float80>);
-  BENCHMARK(doubledouble<__float128>);
-#if HAVE_LIBGMP
-  BENCHMARK(gmpfloat<128>);
-  BENCHMARK(gmpfloat<256>);
-  BENCHMARK(mpf_class);
-#endif
-  benchmark<mpfrfloat<128, MPFR_RNDN>>("mpfrfloat<128, MPFR_RNDN>");
-  benchmark<mpfrfloat<128, MPFR_RNDZ>>("mpfrfloat<128, MPFR_RNDZ>");
-  benchmark<mpfrfloat<256, MPFR_RNDN>>("mpfrfloat<256, MPFR_RNDN>");
-  benchmark<mpfrfloat<256, MPFR_RNDZ>>("mpfrfloat<256, MPFR_RNDZ>");
-  // benchmark<mpfrfloat<256, MPFR_RNDU>>("mpfrfloat<256, MPFR_RNDU>");
-  // benchmark<mpfrfloat<256, MPFR_RNDD>>("mpfrfloat<256, MPFR_RNDD>");
-  // benchmark<mpfrfloat<256, MPFR_RNDA>>("mpfrfloat<256, MPFR_RNDA>");
-  // benchmark<mpfrfloat<256, MPFR_RNDF>>("mpfrfloat<256, MPFR_RNDF>");
-  // benchmark<mpfrfloat<256, MPFR_RNDNA>>("mpfrfloat<256, MPFR_RNDNA>");
+int main(int argc, char **argv) {
+  try {
+    parse_options(argc, argv);
+  } catch (const std::exception &exc) {
+    std::cerr << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << std::left << std::setw(48) << "benchmark" << std::right
+            << std::setw(13) << "median" << std::setw(10) << "p10"
+            << std::setw(10) << "p90" << std::endl;
+
+  for (const auto &v : viewports) {
+    for (int type = FT_AUTO + 1; type < FT_MAX; ++type) {
+      with_float_type(FloatType(type), [&](auto tag) {
+        benchmark_kernel<typename decltype(tag)::type>(floattypenames[type],
+                                                       v);
+      });
+    }
+    benchmark_kernel<mpfrfloat<128, MPFR_RNDN>>("mpfrfloat<128, MPFR_RNDN>", v);
+    benchmark_kernel<mpfrfloat<128, MPFR_RNDZ>>("mpfrfloat<128, MPFR_RNDZ>", v);
+    benchmark_kernel<mpfrfloat<256, MPFR_RNDN>>("mpfrfloat<256, MPFR_RNDN>", v);
+    benchmark_kernel<mpfrfloat<256, MPFR_RNDZ>>("mpfrfloat<256, MPFR_RNDZ>", v);
+    benchmark_kernel<floatexp>("floatexp", v);
+  }
+
+  // Thread scaling: 1, 2, 4, ... up to one thread per CPU
+  const int cpus = available_cpus().size();
+  for (int threads = 1; threads < cpus; threads *= 2) benchmark_frames(threads);
+  benchmark_frames(cpus);
+
+  if (!options.json_file.empty()) {
+    std::ofstream of(options.json_file);
+    write_json(of);
+  }
+  return EXIT_SUCCESS;
 }
@@ -0,0 +1,122 @@
+#include "bookmark.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "exact.hpp"
+
+const char *bookmark_file = "bookmarks";
+
+/// Version of the text and binary forms
+static const int position_version = 1;
+static const char text_magic[] = "mandelbrot-view";
+static const char binary_magic[] = "MBV";
+/// The bookmark file is the magic, then a byte per slot telling if the slot
+/// is used, followed by the binary form of the position if so
+static const char bookmark_magic[] = "MBBM";
+
+std::string position_to_text(const view_position &pos) {
+  return std::string(text_magic) + " " + std::to_string(position_version) +
+         " " + exact_string(pos.center_x) + " " + exact_string(pos.center_y) +
+         " " + exact_string(pos.size);
+}
+
+bool position_from_text(const std::string &text, view_position &pos) {
+  std::istringstream is(text);
+  std::string magic, x, y, size;
+  int version = 0;
+  is >> magic >> version >> x >> y >> size;
+  view_position result;
+  if (!is || magic != text_magic || version != position_version ||
+      !parse_exact(x, result.center_x) || !parse_exact(y, result.center_y) ||
+      !parse_exact(size, result.size))
+    return false;
+  pos = result;
+  return true;
+}
+
+void write_position(std::ostream &os, const view_position &pos) {
+  os.write(binary_magic, 3);
+  os.put(char(position_version));
+  write_parts(os, to_parts(pos.center_x));
+  write_parts(os, to_parts(pos.center_y));
+  write_parts(os, to_parts(pos.size));
+}
+
+bool read_position(std::istream &is, view_position &pos) {
+  char magic[4] = {};
+  exact_parts x, y, size;
+  if (!is.read(magic, 4) || std::string(magic, 3) != binary_magic ||
+      magic[3] != char(position_version) || !read_parts(is, x) ||
+      !read_parts(is, y) || !read_parts(is, size))
+    return false;
+  from_parts(x, pos.center_x);
+  from_parts(y, pos.center_y);
+  from_parts(size, pos.size);
+  return true;
+}
+
+/**
+ * Read all slots of a bookmark file. A missing file has no bookmarks.
+ * Returns false if the file exists but is malformed; the slots before the
+ * malformed one are still read.
+ */
+static bool read_bookmarks(const char *path, bool used[],
+                           view_position positions[]) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    std::error_code error;
+    return !std::filesystem::exists(path, error) && !error;
+  }
+  char magic[4];
+  if (!in.read(magic, 4) || std::string(magic, 4) != bookmark_magic)
+    return false;
+  for (int slot = 0; slot < bookmark_slots; ++slot) {
+    const int flag = in.get();
+    if (flag == 0) continue;
+    // Positions differ in length, so the slots after a malformed one can not
+    // be found
+    if (flag != 1 || !read_position(in, positions[slot])) return false;
+    used[slot] = true;
+  }
+  return true;
+}
+
+bool save_bookmark(const char *path, int slot, const view_position &pos) {
+  if (slot < 0 || slot >= bookmark_slots) return false;
+  bool used[bookmark_slots] = {};
+  view_position positions[bookmark_slots];
+  // Rewriting a malformed file would drop the slots that could not be read
+  if (!read_bookmarks(path, used, positions)) return false;
+  used[slot] = true;
+  positions[slot] = pos;
+
+  // Written to a temporary file that replaces the old one, so that a crash
+  // while writing leaves the old bookmarks intact
+  const std::string temporary = std::string(path) + ".tmp";
+  std::ofstream of(temporary, std::ios::binary | std::ios::trunc);
+  of.write(bookmark_magic, 4);
+  for (int i = 0; i < bookmark_slots; ++i) {
+    of.put(char(used[i]));
+    if (used[i]) write_position(of, positions[i]);
+  }
+  of.close();
+  std::error_code error;
+  if (of) std::filesystem::rename(temporary, path, error);
+  if (!of || error) {
+    std::filesystem::remove(temporary, error);
+    return false;
+  }
+  return true;
+}
+
+bool load_bookmark(const char *path, int slot, view_position &pos) {
+  if (slot < 0 || slot >= bookmark_slots) return false;
+  bool used[bookmark_slots] = {};
+  view_position positions[bookmark_slots];
+  read_bookmarks(path, used, positions);
+  if (!used[slot]) return false;
+  pos = positions[slot];
+  return true;
+}
@@ -0,0 +1,58 @@
+/**
+ * @file bookmark.hpp
+ *
+ * Exact serialization of view positions, and bookmarks of positions stored
+ * in a file.
+ */
+
+#ifndef _bookmark_hpp
+#define _bookmark_hpp
+
+#include <iosfwd>
+#include <string>
+
+#include "float.hpp"
+
+/// A position in the complex plane and the height of the view
+struct view_position {
+  flt center_x;
+  flt center_y;
+  flt size;
+};
+
+/**
+ * Text form, a single line "mandelbrot-view 1 X Y SIZE" with the numbers in
+ * the exact text format of exact.hpp. 1 is the format version.
+ */
+std::string position_to_text(const view_position &pos);
+
+/// Parse the text form. Returns false if malformed or of another version.
+bool position_from_text(const std::string &text, view_position &pos);
+
+/**
+ * Binary form, the magic "MBV" and a version byte followed by the numbers in
+ * the binary format of exact.hpp.
+ */
+void write_position(std::ostream &os, const view_position &pos);
+
+/// Read the binary form. Returns false if malformed or of another version.
+bool read_position(std::istream &is, view_position &pos);
+
+/// Number of bookmark slots
+static const int bookmark_slots = 10;
+
+/// File storing the bookmarks, in the working directory
+extern const char *bookmark_file;
+
+/**
+ * Store a position in a bookmark slot of the file, keeping the other slots.
+ * The file is written next to the old one and then renamed over it. Returns
+ * false if the file could not be written, or if the existing file is
+ * malformed, which is then left alone.
+ */
+bool save_bookmark(const char *path, int slot, const view_position &pos);
+
+/// Load a bookmark. Returns false if the slot is empty or unreadable.
+bool load_bookmark(const char *path, int slot, view_position &pos);
+
+#endif  // _bookmark_hpp
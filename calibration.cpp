@@ -0,0 +1,177 @@
+/**
+ * @file calibration.cpp
+ *
+ * Run-time calibration of the floating point types. The relative speed of the
+ * types differs between CPUs, so the auto selection uses measured numbers
+ * instead of a fixed order.
+ */
+
+#include "calibration.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "floatdispatch.hpp"
+#include "mandelbrot.hpp"
+
+/// Time spent measuring each type
+static const int CALIBRATION_DURATION = 20;
+
+/// Points iterated per time check
+static const int CALIBRATION_BATCH = 64;
+
+/// Measured iterations per millisecond for each type
+static double throughput[FT_MAX];
+
+/// Identify the CPU, so a profile is not reused on a different machine.
+static std::string cpu_model() {
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      auto colon = line.find(':');
+      if (colon != std::string::npos) return line.substr(colon + 2);
+    }
+  }
+  return "unknown";
+}
+
+/**
+ * Measure iterations per millisecond for one type. Iterates a fixed grid of
+ * points in seahorse valley, which has a mix of escaping and interior points
+ * that are not caught by isinside().
+ */
+template <typename FLT>
+static double measure() {
+  using clock = std::chrono::high_resolution_clock;
+  unsigned long total = 0;
+  int point = 0;
+  auto start = clock::now();
+  auto elapsed = clock::duration::zero();
+  do {
+    for (int i = 0; i < CALIBRATION_BATCH; ++i, ++point) {
+      FLT xc = FLT(-0.75 + 0.01 * (point % 97) / 97.0);
+      FLT yc = FLT(0.1 + 0.01 * (point % 89) / 89.0);
+      total += iter(xc, yc).iterations;
+    }
+    elapsed = clock::now() - start;
+  } while (elapsed < std::chrono::milliseconds(CALIBRATION_DURATION));
+  return total / std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+/**
+ * Floating point types that can be used for auto selection together with
+ * their epsilon, ordered from fastest to slowest on this machine.
+ */
+static std::vector<std::pair<FloatType, flt>> type_order;
+
+/// Order the float types by measured throughput.
+static void order_types() {
+  type_order.clear();
+  for (int type = FT_AUTO + 1; type < FT_MAX; ++type) {
+    with_float_type(FloatType(type), [&](auto tag) {
+      using FLT = typename decltype(tag)::type;
+      type_order.emplace_back(FloatType(type),
+                              flt(std::numeric_limits<FLT>::epsilon()));
+    });
+  }
+  std::stable_sort(type_order.begin(), type_order.end(),
+                   [](const auto &a, const auto &b) {
+                     return calibration_throughput(a.first) >
+                            calibration_throughput(b.first);
+                   });
+}
+
+std::string calibration_default_path() {
+  const char *cache = std::getenv("XDG_CACHE_HOME");
+  if (cache != nullptr && *cache != '\0')
+    return std::string(cache) + "/mandelbrot/calibration";
+  const char *home = std::getenv("HOME");
+  if (home != nullptr && *home != '\0')
+    return std::string(home) + "/.cache/mandelbrot/calibration";
+  return "";
+}
+
+/**
+ * Parse a throughput from the profile. Returns 0, so the type is measured
+ * again, unless the whole value is a positive finite number.
+ */
+static double parse_throughput(const std::string &value) {
+  char *end;
+  const double result = std::strtod(value.c_str(), &end);
+  if (end == value.c_str() || *end != '\0' || !std::isfinite(result) ||
+      result <= 0.0)
+    return 0.0;
+  return result;
+}
+
+/// Load the profile, measuring the types missing from it.
+static void load_profile(const std::string &path) {
+  const std::string cpu = cpu_model();
+  bool complete = true;
+
+  std::ifstream inf(path);
+  std::string line;
+  if (!path.empty() && std::getline(inf, line) && line == "cpu " + cpu) {
+    while (std::getline(inf, line)) {
+      auto space = line.rfind(' ');
+      if (space == std::string::npos) continue;
+      std::string name = line.substr(0, space);
+      for (int type = FT_AUTO + 1; type < FT_MAX; ++type) {
+        if (name == floattypenames[type])
+          throughput[type] = parse_throughput(line.substr(space + 1));
+      }
+    }
+  }
+
+  for (int type = FT_AUTO + 1; type < FT_MAX; ++type) {
+    if (throughput[type] > 0.0) continue;
+    if (complete) std::cout << "calibrating float types" << std::endl;
+    complete = false;
+    with_float_type(FloatType(type), [type](auto tag) {
+      throughput[type] = measure<typename decltype(tag)::type>();
+    });
+    std::cout << floattypenames[type] << ": " << throughput[type]
+              << " iterations/msec" << std::endl;
+  }
+
+  if (!complete && !path.empty()) {
+    std::error_code error;
+    std::filesystem::create_directories(
+        std::filesystem::path(path).parent_path(), error);
+    std::ofstream of(path);
+    of << "cpu " << cpu << '\n';
+    for (int type = FT_AUTO + 1; type < FT_MAX; ++type)
+      of << floattypenames[type] << ' ' << throughput[type] << '\n';
+  }
+
+  order_types();
+}
+
+void calibration_load(const std::string &path) {
+  static std::once_flag loaded;
+  std::call_once(loaded, load_profile, path);
+}
+
+double calibration_throughput(FloatType type) { return throughput[type]; }
+
+FloatType calibration_select_type(const flt &pixel_size, double magnitude) {
+  const flt delta =
+      pixel_size / flt(std::max(magnitude, calibration_min_magnitude));
+  const std::pair<FloatType, flt> *best = nullptr;
+  for (const auto &type : type_order) {
+    if (delta > type.second) return type.first;
+    if (best == nullptr || type.second < best->second) best = &type;
+  }
+  // Nothing is precise enough; use the most precise type available.
+  return best->first;
+}
+
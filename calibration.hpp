@@ -0,0 +1,49 @@
+/**
+ * @file calibration.hpp
+ *
+ * Measured throughput of each floating point type on this machine.
+ */
+
+#ifndef _calibration_hpp
+#define _calibration_hpp
+
+#include <string>
+
+#include "float.hpp"
+#include "floattype.hpp"
+
+/**
+ * Per-user file storing the profile: $XDG_CACHE_HOME/mandelbrot/calibration,
+ * or ~/.cache/mandelbrot/calibration. Empty if neither variable is set.
+ */
+std::string calibration_default_path();
+
+/**
+ * Load the calibration profile from file. Types missing from the profile or
+ * with unreadable entries, or all types if the profile was made on a
+ * different CPU, are measured and the profile is written back. With an empty
+ * path, all types are measured and nothing is written. Only the first call
+ * loads the profile, and the others wait for it to finish and then return,
+ * so the type order never changes while calibration_select_type() is used.
+ */
+void calibration_load(const std::string &path);
+
+/// Measured throughput of a type in iterations per millisecond
+double calibration_throughput(FloatType type);
+
+/**
+ * Smallest magnitude used by calibration_select_type(). Whatever the point,
+ * its orbit is iterated up to the escape radius 2, where the spacing between
+ * representable numbers is largest.
+ */
+const double calibration_min_magnitude = 2.0;
+
+/**
+ * Chose the floating point type that is the fastest at the require precision.
+ * The precision needed depends on both the pixel size and the magnitude of
+ * the coordinates, since the spacing between representable numbers grows with
+ * the magnitude. Requires calibration_load().
+ */
+FloatType calibration_select_type(const flt &pixel_size, double magnitude);
+
+#endif  // _calibration_hpp
@@ -0,0 +1,478 @@
+/**
+ * @file distributed.cpp
+ *
+ * Distributed rendering of a single frame by several worker processes,
+ * possibly on several machines. The coordinator splits the frame into tiles,
+ * and workers pull tiles over TCP, render them on all their cores with a
+ * render_pool and send back the iteration fields compressed with zlib.
+ *
+ *     mandelbrot-distributed coordinator --listen PORT --size WIDTH HEIGHT
+ *         --view CENTER_X CENTER_Y SIZE [--limit N] [--tile PIXELS]
+ *         [--float-type NAME] [--spawn N] [--output FILE.ppm] [--verify]
+ *     mandelbrot-distributed worker --connect HOST:PORT [--threads N]
+ *         [--lanes N]
+ *
+ * With --spawn the coordinator starts N local workers itself. With --verify
+ * it also renders the whole frame locally and compares the fields, which
+ * only match exactly with a fixed --float-type: with automatic selection a
+ * tile may choose a different type than the whole frame does for a row.
+ *
+ * Protocol, one request or reply per line:
+ *
+ *     worker:      next
+ *     coordinator: tile ID WIDTH HEIGHT LIMIT TYPE CENTER_X CENTER_Y SIZE
+ *                  or done
+ *     worker:      result ID BYTES, followed by BYTES of zlib-compressed
+ *                  iteration field, 32 bit floats in host byte order
+ *
+ * Coordinates are in the exact format of exact.hpp, and TYPE is a FloatType,
+ * so all processes must run the same build. A worker runs several lanes,
+ * each with its own connection and tile, so its cores stay busy while a tile
+ * is finishing or in transit. Tiles of a worker that disconnects are handed
+ * out again.
+ */
+
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "affinity.hpp"
+#include "exact.hpp"
+#include "mandelbrot.hpp"
+#include "netio.hpp"
+#include "palette.hpp"
+#include "renderjob.hpp"
+#include "strop.hpp"
+
+extern char **environ;
+
+/// Options from the command line
+struct distributed_options {
+  // Coordinator
+  int port = 0;
+  int width = 0;
+  int height = 0;
+  bool view = false;
+  flt center_x, center_y, size;
+  unsigned int limit = LIMIT;
+  int tile_size = 64;
+  FloatType float_type = FT_AUTO;
+  int spawn = 0;
+  std::string output;
+  bool verify = false;
+  // Worker
+  std::string connect;
+  int threads = 0;
+  int lanes = 2;
+};
+
+/// A rectangle of the frame rendered by a worker
+struct tile {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+/// Frame being rendered by the coordinator, shared by the connections
+struct coordinator_state {
+  int width;
+  int height;
+  unsigned int limit;
+  FloatType float_type;
+  flt min_x;
+  flt min_y;
+  flt pixel_size;
+  std::vector<tile> tiles;
+  std::vector<float> field;
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::deque<int> pending;   /**< Tiles not handed out */
+  std::vector<bool> done;    /**< Tiles received */
+  int remaining = 0;         /**< Tiles not received */
+  bool abandoned = false;    /**< Set when the frame cannot complete */
+  uint64_t raw_bytes = 0;
+  uint64_t compressed_bytes = 0;
+};
+
+static coordinator_state coordinator;
+
+static FloatType parse_float_type(const std::string &name) {
+  for (int type = FT_AUTO; type < FT_MAX; ++type)
+    if (name == floattypenames[type]) return FloatType(type);
+  throw std::runtime_error("unknown float type " + name);
+}
+
+/// The request line handing out a tile
+static std::string tile_line(int id) {
+  const coordinator_state &s = coordinator;
+  const tile &t = s.tiles[id];
+  const flt center_x = s.min_x + flt(t.x + t.width / 2.0) * s.pixel_size;
+  const flt center_y = s.min_y + flt(t.y + t.height / 2.0) * s.pixel_size;
+  std::ostringstream os;
+  os << "tile " << id << " " << t.width << " " << t.height << " " << s.limit
+     << " " << int(s.float_type) << " " << exact_string(center_x) << " "
+     << exact_string(center_y) << " "
+     << exact_string(flt(t.height) * s.pixel_size) << "\n";
+  return os.str();
+}
+
+/// Receive a compressed tile into the frame. Returns false if malformed.
+static bool receive_tile(socket_reader &reader, int id, size_t bytes) {
+  coordinator_state &s = coordinator;
+  if (id < 0 || id >= int(s.tiles.size()) || bytes > (64 << 20)) return false;
+  const tile &t = s.tiles[id];
+  std::vector<unsigned char> compressed(bytes);
+  if (!reader.read_bytes(compressed.data(), bytes)) return false;
+  std::vector<float> data(size_t(t.width) * t.height);
+  uLongf length = data.size() * sizeof(float);
+  if (uncompress(reinterpret_cast<Bytef *>(data.data()), &length,
+                 compressed.data(), bytes) != Z_OK ||
+      length != data.size() * sizeof(float))
+    return false;
+
+  std::lock_guard<std::mutex> lock(s.mtx);
+  // A tile handed out twice, after a worker was presumed gone, is kept once
+  if (s.done[id]) return true;
+  for (int row = 0; row < t.height; ++row)
+    std::copy_n(data.data() + row * t.width, t.width,
+                s.field.data() + (t.y + row) * s.width + t.x);
+  s.done[id] = true;
+  s.raw_bytes += length;
+  s.compressed_bytes += bytes;
+  if (--s.remaining == 0) s.cv.notify_all();
+  return true;
+}
+
+/// Hand out tiles to a worker connection and collect the results
+static void serve_worker(int fd) {
+  coordinator_state &s = coordinator;
+  socket_reader reader(fd);
+  std::string line;
+  int assigned = -1;
+  while (reader.read_line(line)) {
+    std::istringstream is(line);
+    std::string command;
+    is >> command;
+    if (command == "next") {
+      std::unique_lock<std::mutex> lock(s.mtx);
+      // Wait for tiles of lost workers until the frame is complete
+      while (s.pending.empty() && s.remaining > 0 && !s.abandoned)
+        s.cv.wait(lock);
+      std::string reply = "done\n";
+      if (!s.pending.empty() && !s.abandoned) {
+        assigned = s.pending.front();
+        s.pending.pop_front();
+        reply = tile_line(assigned);
+      }
+      lock.unlock();
+      if (!write_all(fd, reply.data(), reply.size())) break;
+    } else if (command == "result") {
+      int id = -1;
+      size_t bytes = 0;
+      is >> id >> bytes;
+      if (!is || !receive_tile(reader, id, bytes)) break;
+      if (id == assigned) assigned = -1;
+    } else {
+      break;
+    }
+  }
+  std::lock_guard<std::mutex> lock(s.mtx);
+  if (assigned >= 0 && !s.done[assigned]) {
+    s.pending.push_front(assigned);
+    s.cv.notify_all();
+  }
+}
+
+/// Start a local worker process connecting to the coordinator
+static pid_t spawn_worker(const char *program, int port, int threads) {
+  std::vector<std::string> args = {program,
+                                   "worker",
+                                   "--connect",
+                                   "127.0.0.1:" + std::to_string(port),
+                                   "--threads",
+                                   std::to_string(threads)};
+  std::vector<char *> argv;
+  for (auto &arg : args) argv.push_back(&arg[0]);
+  argv.push_back(nullptr);
+  pid_t pid;
+  int rc = posix_spawnp(&pid, program, nullptr, nullptr, argv.data(), environ);
+  if (rc != 0)
+    throw std::runtime_error("spawn " + std::string(program) + ": " +
+                             strerror(rc));
+  return pid;
+}
+
+static void write_ppm(const std::string &path, const std::vector<float> &field,
+                      int width, int height, unsigned int limit) {
+  static const palette pal;
+  std::ofstream of(path, std::ios::binary);
+  if (!of) throw std::runtime_error("cannot write " + path);
+  of << "P6\n" << width << " " << height << "\n255\n";
+  for (float value : field) {
+    const uint32_t color = value == float(limit) ? 0x00 : pal.color(value);
+    const char rgb[3] = {char(color >> 24), char(color >> 16),
+                         char(color >> 8)};
+    of.write(rgb, 3);
+  }
+}
+
+/// Render the whole frame locally and count the pixels that differ
+static int verify(const distributed_options &options, const flt &center_x,
+                  const flt &center_y, const flt &size) {
+  const coordinator_state &s = coordinator;
+  render_pool pool;
+  render_job job(pool, s.width, s.height);
+  job.set_view(center_x, center_y, size);
+  job.set_limit(s.limit);
+  job.set_float_type(options.float_type);
+  job.start();
+  job.wait();
+  int differing = 0;
+  for (size_t i = 0; i < s.field.size(); ++i) {
+    const float local = job.iterations()[i];
+    const bool inside_local = local == float(s.limit);
+    const bool inside = s.field[i] == float(s.limit);
+    if (inside != inside_local || std::abs(local - s.field[i]) > 0.01f)
+      ++differing;
+  }
+  return differing;
+}
+
+static int run_coordinator(const distributed_options &options,
+                           const char *program) {
+  coordinator_state &s = coordinator;
+  const flt &center_x = options.center_x;
+  const flt &center_y = options.center_y;
+  const flt &size = options.size;
+  s.width = options.width;
+  s.height = options.height;
+  s.limit = options.limit;
+  s.float_type = options.float_type;
+  s.pixel_size = size / flt(s.height);
+  s.min_x = center_x - s.width * s.pixel_size / flt(2.0);
+  s.min_y = center_y - s.height * s.pixel_size / flt(2.0);
+  s.field.resize(size_t(s.width) * s.height);
+  for (int y = 0; y < s.height; y += options.tile_size)
+    for (int x = 0; x < s.width; x += options.tile_size)
+      s.tiles.push_back({x, y, std::min(options.tile_size, s.width - x),
+                         std::min(options.tile_size, s.height - y)});
+  for (size_t i = 0; i < s.tiles.size(); ++i) s.pending.push_back(i);
+  s.done.resize(s.tiles.size());
+  s.remaining = s.tiles.size();
+
+  const int listen_fd = listen_tcp(options.port);
+  const int port = local_port(listen_fd);
+  std::cout << "coordinating " << s.tiles.size() << " tiles on port " << port
+            << std::endl;
+  const auto start = std::chrono::steady_clock::now();
+
+  std::vector<pid_t> children;
+  const int cpus = available_cpus().size();
+  for (int i = 0; i < options.spawn; ++i)
+    children.push_back(
+        spawn_worker(program, port, std::max(1, cpus / options.spawn)));
+
+  std::mutex connections_mutex;
+  std::vector<int> connections;
+  std::vector<std::thread> threads;
+  std::thread acceptor([&] {
+    int fd;
+    while ((fd = accept(listen_fd, nullptr, nullptr)) >= 0 ||
+           errno == EINTR) {
+      if (fd < 0) continue;
+      std::lock_guard<std::mutex> lock(connections_mutex);
+      connections.push_back(fd);
+      threads.push_back(std::thread(serve_worker, fd));
+    }
+  });
+
+  // Give up if the local workers all exit before the frame is complete
+  std::thread reaper([&] {
+    for (pid_t pid : children) waitpid(pid, nullptr, 0);
+    std::lock_guard<std::mutex> lock(s.mtx);
+    if (!children.empty() && s.remaining > 0) s.abandoned = true;
+    s.cv.notify_all();
+  });
+
+  {
+    std::unique_lock<std::mutex> lock(s.mtx);
+    while (s.remaining > 0 && !s.abandoned) s.cv.wait(lock);
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+  // Stop accepting, and end the connections once the workers were told
+  shutdown(listen_fd, SHUT_RDWR);
+  acceptor.join();
+  close(listen_fd);
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    for (int fd : connections) shutdown(fd, SHUT_RD);
+  }
+  for (auto &t : threads) t.join();
+  for (int fd : connections) close(fd);
+  reaper.join();
+  if (s.abandoned) {
+    std::cerr << "all workers exited before the frame was complete"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "rendered " << s.width << "x" << s.height << " in " << seconds
+            << " s, " << s.compressed_bytes << " bytes transferred for "
+            << s.raw_bytes << " bytes of iterations" << std::endl;
+  if (!options.output.empty())
+    write_ppm(options.output, s.field, s.width, s.height, s.limit);
+  if (options.verify) {
+    const int differing = verify(options, center_x, center_y, size);
+    std::cout << differing << " of " << s.field.size()
+              << " pixels differ from a local render" << std::endl;
+    if (differing > 0) return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+/// Pull, render and return tiles over one connection until told done
+static void worker_lane(render_pool &pool, const std::string &address) {
+  const int fd = connect_tcp(address);
+  socket_reader reader(fd);
+  std::string line;
+  while (write_all(fd, "next\n", 5) && reader.read_line(line)) {
+    std::istringstream is(line);
+    std::string command, x, y, size;
+    int id, width, height, type;
+    unsigned int limit;
+    is >> command;
+    if (command == "done") break;
+    is >> id >> width >> height >> limit >> type >> x >> y >> size;
+    flt center_x, center_y, tile_size;
+    if (command != "tile" || !is || width <= 0 || height <= 0 || type < 0 ||
+        type >= FT_MAX || !parse_exact(x, center_x) ||
+        !parse_exact(y, center_y) || !parse_exact(size, tile_size)) {
+      std::cerr << "invalid request: " << line << std::endl;
+      break;
+    }
+
+    render_job job(pool, width, height);
+    job.set_view(center_x, center_y, tile_size);
+    job.set_limit(limit);
+    job.set_float_type(FloatType(type));
+    job.start();
+    job.wait();
+
+    const uLong length = uLong(width) * height * sizeof(float);
+    std::vector<Bytef> compressed(compressBound(length));
+    uLongf compressed_length = compressed.size();
+    compress2(compressed.data(), &compressed_length,
+              reinterpret_cast<const Bytef *>(job.iterations()), length,
+              Z_BEST_SPEED);
+    const std::string header = "result " + std::to_string(id) + " " +
+                               std::to_string(compressed_length) + "\n";
+    if (!write_all(fd, header.data(), header.size()) ||
+        !write_all(fd, compressed.data(), compressed_length))
+      break;
+  }
+  close(fd);
+}
+
+static int run_worker(const distributed_options &options) {
+  render_pool pool(options.threads);
+  std::vector<std::thread> lanes;
+  for (int i = 0; i < options.lanes; ++i)
+    lanes.push_back(std::thread([&] {
+      try {
+        worker_lane(pool, options.connect);
+      } catch (const std::exception &exc) {
+        std::cerr << exc.what() << std::endl;
+      }
+    }));
+  for (auto &lane : lanes) lane.join();
+  return EXIT_SUCCESS;
+}
+
+static distributed_options parse_options(int argc, char **argv,
+                                         std::string &mode) {
+  distributed_options options;
+  if (argc > 1) mode = argv[1];
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--listen" && i + 1 < argc) {
+      options.port = std::stoi(argv[++i]);
+    } else if (arg == "--size" && i + 2 < argc) {
+      options.width = std::stoi(argv[++i]);
+      options.height = std::stoi(argv[++i]);
+    } else if (arg == "--view" && i + 3 < argc &&
+               parse_number(argv[i + 1], options.center_x) &&
+               parse_number(argv[i + 2], options.center_y) &&
+               parse_number(argv[i + 3], options.size)) {
+      options.view = true;
+      i += 3;
+    } else if (arg == "--limit" && i + 1 < argc) {
+      options.limit = std::stoi(argv[++i]);
+    } else if (arg == "--tile" && i + 1 < argc) {
+      options.tile_size = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--float-type" && i + 1 < argc) {
+      options.float_type = parse_float_type(argv[++i]);
+    } else if (arg == "--spawn" && i + 1 < argc) {
+      options.spawn = std::stoi(argv[++i]);
+    } else if (arg == "--output" && i + 1 < argc) {
+      options.output = argv[++i];
+    } else if (arg == "--verify") {
+      options.verify = true;
+    } else if (arg == "--connect" && i + 1 < argc) {
+      options.connect = argv[++i];
+    } else if (arg == "--threads" && i + 1 < argc) {
+      options.threads = std::stoi(argv[++i]);
+    } else if (arg == "--lanes" && i + 1 < argc) {
+      options.lanes = std::max(1, std::stoi(argv[++i]));
+    } else {
+      mode.clear();
+      break;
+    }
+  }
+  const bool valid =
+      (mode == "coordinator" && options.width > 0 && options.height > 0 &&
+       options.view) ||
+      (mode == "worker" && !options.connect.empty());
+  if (!valid)
+    throw std::runtime_error(
+        "usage: " + std::string(argv[0]) +
+        " coordinator --listen PORT --size WIDTH HEIGHT"
+        " --view CENTER_X CENTER_Y SIZE [--limit N] [--tile PIXELS]"
+        " [--float-type NAME] [--spawn N] [--output FILE] [--verify]\n"
+        "       " +
+        argv[0] + " worker --connect HOST:PORT [--threads N] [--lanes N]");
+  return options;
+}
+
+int main(int argc, char **argv) {
+  try {
+    std::string mode;
+    const distributed_options options = parse_options(argc, argv, mode);
+    if (mode == "coordinator") return run_coordinator(options, argv[0]);
+    return run_worker(options);
+  } catch (const std::exception &exc) {
+    std::cerr << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
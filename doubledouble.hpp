@@ -2,6 +2,8 @@
 #define _doubledouble_hpp
 
 #include <cmath>
+#include <cstdint>
+#include <limits>
 
 template <typename FLT>
 class doubledouble {
@@ -35,10 +37,17 @@ doubledouble<FLT> two_sum(FLT x, FLT y) {
   return doubledouble<FLT>(r, e);
 }
 
+/// Veltkamp splitting factor, 2^ceil(digits/2) + 1, of the base type
+template <typename FLT>
+FLT split_factor() {
+  const int half = (std::numeric_limits<FLT>::digits + 1) / 2;
+  return FLT((std::uint64_t(1) << half) + 1);
+}
+
 template <typename FLT>
 doubledouble<FLT> two_product(FLT x, FLT y) {
-  FLT u = x * 134217729.0;
-  FLT v = y * 134217729.0;
+  FLT u = x * split_factor<FLT>();
+  FLT v = y * split_factor<FLT>();
   FLT s = u - (u - x);
   FLT t = v - (v - y);
   FLT f = x - s;
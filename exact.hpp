@@ -0,0 +1,376 @@
+/**
+ * @file exact.hpp
+ *
+ * Exact representation of floating point numbers, for storing and passing
+ * coordinates between processes without losing precision. Unlike the decimal
+ * streaming operators in strop.hpp, every number is split into its binary
+ * fraction and exponent, so nothing is rounded and no decimal conversion is
+ * needed. All types share the same representation, so a number written from
+ * one type can be read into another, rounded only if it has less precision.
+ */
+
+#ifndef _exact_hpp
+#define _exact_hpp
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "doubledouble.hpp"
+#include "float.hpp"
+#if HAVE_FLOAT128
+#include <quadmath.h>
+#endif
+
+/**
+ * A number as +-0.words * 2^exponent, with the most significant 64 bits of
+ * the fraction first. Zero has no words.
+ */
+struct exact_parts {
+  bool negative = false;
+  long exponent = 0;
+  std::vector<uint64_t> words;
+};
+
+/// Scale by a power of two, for the native types
+inline long double exact_ldexp(long double f, int exp) {
+  return std::ldexp(f, exp);
+}
+inline long double exact_frexp(long double f, int *exp) {
+  return std::frexp(f, exp);
+}
+#if HAVE_FLOAT128
+inline __float128 exact_ldexp(__float128 f, int exp) { return ldexpq(f, exp); }
+inline __float128 exact_frexp(__float128 f, int *exp) {
+  return frexpq(f, exp);
+}
+/// Widest native type, which holds every other native type exactly
+typedef __float128 exact_native;
+#else
+typedef long double exact_native;
+#endif
+
+template <typename FLT>
+exact_parts to_parts(const FLT &f) {
+  exact_parts parts;
+  exact_native m = f;
+  // Zero, and also infinities and NaN which have no exact form
+  if (m == 0 || m - m != 0) return parts;
+  parts.negative = m < 0;
+  int exp;
+  m = exact_frexp(parts.negative ? -m : m, &exp);
+  parts.exponent = exp;
+  while (m != 0) {
+    m = exact_ldexp(m, 64);
+    const uint64_t word = uint64_t(m);
+    parts.words.push_back(word);
+    m -= exact_native(word);
+  }
+  return parts;
+}
+
+template <typename FLT>
+void from_parts(const exact_parts &parts, FLT &f) {
+  exact_native m = 0;
+  // Least significant first, so that the sum is exact when it fits
+  for (size_t i = parts.words.size(); i-- > 0;) {
+    m += exact_ldexp(exact_native(parts.words[i]),
+                     int(parts.exponent - 64 * long(i + 1)));
+  }
+  f = FLT(parts.negative ? -m : m);
+}
+
+/// Magnitude of parts as an integer times 2^low, least significant word first
+inline std::vector<uint64_t> exact_integer(const exact_parts &parts,
+                                           long low) {
+  const long shift = parts.exponent - 64 * long(parts.words.size()) - low;
+  std::vector<uint64_t> integer(shift / 64 + parts.words.size() + 1, 0);
+  const int bits = int(shift % 64);
+  for (size_t i = 0; i < parts.words.size(); ++i) {
+    const uint64_t word = parts.words[parts.words.size() - 1 - i];
+    integer[shift / 64 + i] |= word << bits;
+    if (bits != 0) integer[shift / 64 + i + 1] |= word >> (64 - bits);
+  }
+  return integer;
+}
+
+/**
+ * Parts of an integer times 2^low, given least significant word first. The
+ * result is normalized: the top bit of the first word is set.
+ */
+inline exact_parts exact_from_integer(std::vector<uint64_t> integer, long low,
+                                      bool negative) {
+  exact_parts parts;
+  while (!integer.empty() && integer.back() == 0) integer.pop_back();
+  if (integer.empty()) return parts;
+  const int leading = __builtin_clzll(integer.back());
+  if (leading != 0) {
+    for (size_t i = integer.size(); i-- > 0;) {
+      integer[i] <<= leading;
+      if (i > 0) integer[i] |= integer[i - 1] >> (64 - leading);
+    }
+  }
+  parts.negative = negative;
+  parts.exponent = low + 64 * long(integer.size()) - leading;
+  size_t end = 0;
+  while (integer[end] == 0) ++end;
+  for (size_t i = integer.size(); i-- > end;) parts.words.push_back(integer[i]);
+  return parts;
+}
+
+/// Lowest exponent of the words of parts
+inline long exact_low(const exact_parts &parts) {
+  return parts.exponent - 64 * long(parts.words.size());
+}
+
+/// Exact sum of two numbers
+inline exact_parts add_parts(const exact_parts &a, const exact_parts &b) {
+  if (a.words.empty() && !b.words.empty()) return add_parts(b, a);
+  if (b.words.empty()) {
+    return exact_from_integer(exact_integer(a, exact_low(a)), exact_low(a),
+                              a.negative);
+  }
+  const long low = std::min(exact_low(a), exact_low(b));
+  std::vector<uint64_t> x = exact_integer(a, low);
+  std::vector<uint64_t> y = exact_integer(b, low);
+  const size_t size = std::max(x.size(), y.size()) + 1;
+  x.resize(size);
+  y.resize(size);
+  bool negative = a.negative;
+  if (a.negative == b.negative) {
+    uint64_t carry = 0;
+    for (size_t i = 0; i < size; ++i) {
+      const uint64_t sum = x[i] + y[i];
+      const uint64_t total = sum + carry;
+      carry = sum < x[i] || total < sum;
+      x[i] = total;
+    }
+  } else {
+    // Subtract the smaller magnitude from the larger
+    if (std::lexicographical_compare(x.rbegin(), x.rend(), y.rbegin(),
+                                     y.rend())) {
+      std::swap(x, y);
+      negative = b.negative;
+    }
+    uint64_t borrow = 0;
+    for (size_t i = 0; i < size; ++i) {
+      const uint64_t difference = x[i] - y[i] - borrow;
+      borrow = x[i] < y[i] || (x[i] == y[i] && borrow);
+      x[i] = difference;
+    }
+  }
+  return exact_from_integer(x, low, negative);
+}
+
+/**
+ * Round to the nearest number of digits bits, ties to even, like the
+ * hardware does.
+ */
+inline exact_parts round_parts(const exact_parts &parts, int digits) {
+  exact_parts rounded = add_parts(parts, exact_parts());
+  auto bit = [&](size_t index) {
+    return index / 64 < rounded.words.size() &&
+           (rounded.words[index / 64] >> (63 - index % 64) & 1);
+  };
+  const bool half = bit(digits);
+  bool sticky = false;
+  for (size_t i = digits + 1; i < 64 * rounded.words.size(); ++i)
+    sticky = sticky || bit(i);
+  const bool odd = bit(digits - 1);
+  for (size_t i = 0; i < rounded.words.size(); ++i) {
+    const long keep = std::clamp(long(digits) - 64 * long(i), 0L, 64L);
+    if (keep < 64) rounded.words[i] &= keep == 0 ? 0 : ~0ULL << (64 - keep);
+  }
+  if (half && (sticky || odd)) {
+    exact_parts ulp;
+    ulp.negative = rounded.negative;
+    ulp.exponent = rounded.exponent - digits + 1;
+    ulp.words.push_back(uint64_t(1) << 63);
+    rounded = add_parts(rounded, ulp);
+  }
+  return add_parts(rounded, exact_parts());
+}
+
+/// The sum of the high and low part, which no native type holds exactly
+template <typename FLT>
+exact_parts to_parts(const doubledouble<FLT> &f) {
+  return add_parts(to_parts(f.r), to_parts(f.e));
+}
+
+/**
+ * The high part is the number rounded to the precision of FLT and the low
+ * part the rest, rounded, so a normalized doubledouble round trips exactly.
+ */
+template <typename FLT>
+void from_parts(const exact_parts &parts, doubledouble<FLT> &f) {
+  const exact_parts high =
+      round_parts(parts, std::numeric_limits<FLT>::digits);
+  exact_parts rest = high;
+  rest.negative = !rest.negative;
+  FLT r, e;
+  from_parts(high, r);
+  from_parts(add_parts(parts, rest), e);
+  f = doubledouble<FLT>(r, e);
+}
+
+#if HAVE_LIBGMP
+static_assert(GMP_NUMB_BITS == 32 || GMP_NUMB_BITS == 64,
+              "unsupported GMP limb size");
+
+/// Straight from the limbs, including the guard limb of a gmpfloat
+template <mp_bitcnt_t PREC>
+exact_parts to_parts(const gmpfloat<PREC> &f) {
+  exact_parts parts;
+  const int limbs = std::abs(f.mpf->_mp_size);
+  parts.negative = f.mpf->_mp_size < 0;
+  parts.exponent = long(f.mpf->_mp_exp) * GMP_NUMB_BITS;
+  const int per_word = 64 / GMP_NUMB_BITS;
+  for (int i = limbs - 1; i >= 0; i -= per_word) {
+    uint64_t word = 0;
+    for (int j = 0; j < per_word; ++j) {
+      word <<= GMP_NUMB_BITS % 64;
+      if (i - j >= 0) word |= f.mpf->_mp_d[i - j];
+    }
+    parts.words.push_back(word);
+  }
+  return parts;
+}
+
+/**
+ * Set the limbs directly. Limbs beyond the precision of f are truncated, so
+ * only a number written at a higher precision is rounded.
+ */
+template <mp_bitcnt_t PREC>
+void from_parts(const exact_parts &parts, gmpfloat<PREC> &f) {
+  // Shift the fraction right to align the exponent to whole limbs
+  std::vector<uint64_t> words = parts.words;
+  long exponent = parts.exponent;
+  const int shift =
+      int(((exponent % GMP_NUMB_BITS) + GMP_NUMB_BITS) % GMP_NUMB_BITS);
+  if (shift != 0 && !words.empty()) {
+    const int right = GMP_NUMB_BITS - shift;
+    words.push_back(0);
+    for (size_t i = words.size() - 1; i > 0; --i)
+      words[i] = (words[i] >> right) | (words[i - 1] << (64 - right));
+    words[0] >>= right;
+    exponent += right;
+  }
+
+  std::vector<mp_limb_t> limbs;  // most significant first
+  for (uint64_t word : words) {
+    for (int j = 64 / GMP_NUMB_BITS - 1; j >= 0; --j)
+      limbs.push_back(mp_limb_t(word >> (j * GMP_NUMB_BITS)));
+  }
+  exponent /= GMP_NUMB_BITS;
+  size_t first = 0;
+  while (first < limbs.size() && limbs[first] == 0) {
+    ++first;
+    --exponent;
+  }
+  limbs.erase(limbs.begin(), limbs.begin() + first);
+  while (!limbs.empty() && limbs.back() == 0) limbs.pop_back();
+  // A gmpfloat has room for one limb more than its precision
+  const size_t capacity = f.mpf->_mp_prec + 1;
+  if (limbs.size() > capacity) limbs.resize(capacity);
+  for (size_t i = 0; i < limbs.size(); ++i)
+    f.mpf->_mp_d[limbs.size() - 1 - i] = limbs[i];
+  f.mpf->_mp_size = parts.negative ? -int(limbs.size()) : int(limbs.size());
+  f.mpf->_mp_exp = limbs.empty() ? 0 : exponent;
+}
+#endif
+
+/**
+ * Text form of the parts: the fraction in hexadecimal and the binary
+ * exponent, "-1a2bp-64" for -0x0.1a2b * 2^-64.
+ */
+inline std::string parts_to_string(const exact_parts &parts) {
+  std::string digits;
+  char word[17];
+  for (uint64_t w : parts.words) {
+    std::snprintf(word, sizeof(word), "%016llx", (unsigned long long)w);
+    digits += word;
+  }
+  digits.erase(digits.find_last_not_of('0') + 1);
+  if (digits.empty()) return "0";
+  const size_t zeros = digits.find_first_not_of('0');
+  digits.erase(0, zeros);
+  return (parts.negative ? "-" : "") + digits + "p" +
+         std::to_string(parts.exponent - 4 * long(zeros));
+}
+
+/// Parse the result of parts_to_string(). Returns false if malformed.
+inline bool parts_from_string(const std::string &s, exact_parts &parts) {
+  parts = exact_parts();
+  if (s == "0") return true;
+  parts.negative = !s.empty() && s[0] == '-';
+  const size_t p = s.find('p');
+  if (p == std::string::npos) return false;
+  std::string digits = s.substr(parts.negative, p - parts.negative);
+  char *end;
+  parts.exponent = std::strtol(s.c_str() + p + 1, &end, 10);
+  if (digits.empty() || *end || end == s.c_str() + p + 1 ||
+      digits.find_first_not_of("0123456789abcdef") != std::string::npos)
+    return false;
+  digits.append((16 - digits.size() % 16) % 16, '0');
+  for (size_t i = 0; i < digits.size(); i += 16)
+    parts.words.push_back(
+        std::strtoull(digits.substr(i, 16).c_str(), nullptr, 16));
+  return true;
+}
+
+/**
+ * Binary form of the parts: a flag byte, 1 if negative, the exponent as a
+ * 64 bit and the word count as an 8 bit integer, then the words, all little
+ * endian.
+ */
+inline void write_parts(std::ostream &os, const exact_parts &parts) {
+  auto put = [&](uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) os.put(char(value >> (8 * i)));
+  };
+  size_t count = std::min<size_t>(parts.words.size(), 255);
+  while (count > 0 && parts.words[count - 1] == 0) --count;
+  put(parts.negative, 1);
+  put(uint64_t(int64_t(parts.exponent)), 8);
+  put(count, 1);
+  for (size_t i = 0; i < count; ++i) put(parts.words[i], 8);
+}
+
+/// Read the result of write_parts(). Returns false if malformed.
+inline bool read_parts(std::istream &is, exact_parts &parts) {
+  auto get = [&](int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i)
+      value |= uint64_t(uint8_t(is.get())) << (8 * i);
+    return value;
+  };
+  const uint64_t flags = get(1);
+  parts.negative = flags & 1;
+  parts.exponent = long(int64_t(get(8)));
+  parts.words.resize(get(1));
+  for (auto &word : parts.words) word = get(8);
+  return is && flags <= 1;
+}
+
+/// Exact text representation of a number
+template <typename FLT>
+std::string exact_string(const FLT &f) {
+  return parts_to_string(to_parts(f));
+}
+
+/// Parse the result of exact_string(). Returns false if malformed.
+template <typename FLT>
+bool parse_exact(const std::string &s, FLT &f) {
+  exact_parts parts;
+  if (!parts_from_string(s, parts)) return false;
+  from_parts(parts, f);
+  return true;
+}
+
+#endif  // _exact_hpp
@@ -0,0 +1,92 @@
+/**
+ * @file floatdispatch.hpp
+ *
+ * Mapping from run-time FloatType to compile-time floating point type.
+ */
+
+#ifndef _floatdispatch_hpp
+#define _floatdispatch_hpp
+
+#include <cstdlib>
+
+#include "doubledouble.hpp"
+#include "floatext.hpp"
+#include "floattype.hpp"
+#if HAVE_LIBGMP
+#include "gmpfloat.hpp"
+#endif
+#if HAVE_LIBMPFR
+#include "mpfrfloat.hpp"
+#endif
+
+/// Tag carrying a floating point type to a generic lambda.
+template <typename T>
+struct float_tag {
+  using type = T;
+};
+
+/**
+ * Invoke f with a float_tag for the type identified by type. Used to do the
+ * run-time type switch once and then run fully specialised code.
+ */
+template <typename F>
+void with_float_type(FloatType type, F&& f) {
+  switch (type) {
+    case FT_FLOAT:
+      f(float_tag<float>());
+      break;
+    case FT_DOUBLE:
+      f(float_tag<double>());
+      break;
+    case FT_DOUBLEFLOAT:
+      f(float_tag<doubledouble<float>>());
+      break;
+    case FT_DOUBLEDOUBLE:
+      f(float_tag<doubledouble<double>>());
+      break;
+#if HAVE_FLOAT80
+    case FT_FLOAT80:
+      f(float_tag<__float80>());
+      break;
+    case FT_DOUBLEFLOAT80:
+      f(float_tag<doubledouble<__float80>>());
+      break;
+#endif
+#if HAVE_FLOAT128
+    case FT_FLOAT128:
+      f(float_tag<__float128>());
+      break;
+    case FT_DOUBLEFLOAT128:
+      f(float_tag<doubledouble<__float128>>());
+      break;
+#endif
+#if HAVE_LONG_DOUBLE
+    case FT_LONG_DOUBLE:
+      f(float_tag<long double>());
+      break;
+    case FT_DOUBLELONG_DOUBLE:
+      f(float_tag<doubledouble<long double>>());
+      break;
+#endif
+#if HAVE_LIBGMP
+    case FT_GMPFLOAT128:
+      f(float_tag<gmpfloat<128>>());
+      break;
+    case FT_GMPFLOAT256:
+      f(float_tag<gmpfloat<256>>());
+      break;
+#endif
+#if HAVE_LIBMPFR
+    case FT_MPFRFLOAT128:
+      f(float_tag<mpfrfloat<128, MPFR_RNDN>>());
+      break;
+    case FT_MPFRFLOAT256:
+      f(float_tag<mpfrfloat<256, MPFR_RNDN>>());
+      break;
+#endif
+    default:
+      abort();
+  }
+}
+
+#endif  // _floatdispatch_hpp
@@ -0,0 +1,157 @@
+/**
+ * @file floatexp.hpp
+ *
+ * Double with an extended exponent: a double mantissa and a separate 64 bit
+ * exponent. It has the 53 bit precision of a double at any magnitude, so
+ * numbers far below the range of double, like the deltas of deep zooms,
+ * are computed with hardware arithmetic instead of with GMP.
+ */
+
+#ifndef _floatexp_hpp
+#define _floatexp_hpp
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+/**
+ * A number as m * 2^e. The mantissa is kept normalized to 0.5 <= |m| < 1 by
+ * moving the exponent bits of the double into e after every operation, which
+ * only takes integer operations. Zero has a very low exponent, so that sums
+ * need no special case for it.
+ */
+class floatexp {
+ public:
+  explicit floatexp(double f = 0.0) { set(f, 0); }
+  /// f * 2^exp
+  floatexp(double f, int64_t exp) { set(f, exp); }
+  explicit operator double() const {
+    // Beyond these, the result is 0 or infinite anyway
+    const int64_t clamped = e < -2200 ? -2200 : e > 2200 ? 2200 : e;
+    return std::ldexp(m, int(clamped));
+  }
+  floatexp& operator+=(const floatexp& other);
+  floatexp& operator-=(const floatexp& other);
+
+  static constexpr int64_t zero_exponent =
+      std::numeric_limits<int64_t>::min() / 4;
+
+  double m;  /**< Mantissa */
+  int64_t e; /**< Exponent */
+
+ private:
+  void set(double f, int64_t exp) {
+    uint64_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    const int biased = int(bits >> 52) & 0x7ff;
+    if (biased == 0) {
+      if (f == 0.0) {
+        m = 0.0;
+        e = zero_exponent;
+      } else {
+        // Subnormal, scale into the normal range first
+        set(f * 0x1p64, exp - 64);
+      }
+      return;
+    }
+    if (biased == 0x7ff) {
+      // Infinity or NaN
+      m = f;
+      e = 0;
+      return;
+    }
+    bits = (bits & ~(uint64_t(0x7ff) << 52)) | (uint64_t(1022) << 52);
+    std::memcpy(&m, &bits, sizeof(m));
+    e = exp + biased - 1022;
+  }
+};
+
+/// 2^-d for 0 <= d <= 64, without a call to ldexp
+inline double floatexp_scale_down(int64_t d) {
+  const uint64_t bits = uint64_t(1023 - d) << 52;
+  double f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+inline floatexp operator+(const floatexp& lhs, const floatexp& rhs) {
+  // The smaller operand is aligned to the larger, rounding only once like a
+  // double addition. Beyond 64 bits it does not change the sum.
+  const int64_t d = lhs.e - rhs.e;
+  if (d >= 0) {
+    if (d > 64) return lhs;
+    return floatexp(lhs.m + rhs.m * floatexp_scale_down(d), lhs.e);
+  }
+  if (d < -64) return rhs;
+  return floatexp(rhs.m + lhs.m * floatexp_scale_down(-d), rhs.e);
+}
+
+inline floatexp operator-(const floatexp& f) { return floatexp(-f.m, f.e); }
+
+inline floatexp operator-(const floatexp& lhs, const floatexp& rhs) {
+  return lhs + -rhs;
+}
+
+inline floatexp operator*(const floatexp& lhs, const floatexp& rhs) {
+  return floatexp(lhs.m * rhs.m, lhs.e + rhs.e);
+}
+
+inline floatexp operator/(const floatexp& lhs, const floatexp& rhs) {
+  return floatexp(lhs.m / rhs.m, lhs.e - rhs.e);
+}
+
+inline floatexp& floatexp::operator+=(const floatexp& other) {
+  return *this = *this + other;
+}
+
+inline floatexp& floatexp::operator-=(const floatexp& other) {
+  return *this = *this - other;
+}
+
+inline bool operator<(const floatexp& lhs, const floatexp& rhs) {
+  // Of normalized numbers with the same sign, the one with the larger
+  // exponent has the larger magnitude
+  if (lhs.e == rhs.e || lhs.m == 0.0 || rhs.m == 0.0 ||
+      (lhs.m < 0.0) != (rhs.m < 0.0))
+    return lhs.m < rhs.m;
+  return (lhs.m < 0.0) != (lhs.e < rhs.e);
+}
+
+inline bool operator>(const floatexp& lhs, const floatexp& rhs) {
+  return rhs < lhs;
+}
+
+inline bool operator<(const floatexp& lhs, double rhs) {
+  return lhs < floatexp(rhs);
+}
+
+inline bool operator>(const floatexp& lhs, double rhs) {
+  return floatexp(rhs) < lhs;
+}
+
+inline bool operator==(const floatexp& lhs, const floatexp& rhs) {
+  return lhs.m == rhs.m && lhs.e == rhs.e;
+}
+
+inline bool operator!=(const floatexp& lhs, const floatexp& rhs) {
+  return !(lhs == rhs);
+}
+
+namespace std {
+
+template <>
+class numeric_limits<floatexp> {
+ public:
+  static const size_t digits10 = std::numeric_limits<double>::digits10;
+  static const size_t digits = std::numeric_limits<double>::digits;
+  static floatexp epsilon() {
+    return floatexp(std::numeric_limits<double>::epsilon());
+  }
+};
+
+inline floatexp abs(const floatexp& f) { return floatexp(std::abs(f.m), f.e); }
+
+}  // namespace std
+
+#endif  // _floatexp_hpp
@@ -26,7 +26,11 @@ class gmpfloat {
 
   explicit gmpfloat<PREC>(mpf_t w) { mpf[0] = w[0]; }
 
-  gmpfloat(const gmpfloat<PREC>& g) { mpf_init_set(mpf, g.mpf); }
+  // mpf_init_set() would use the default precision, not PREC
+  gmpfloat(const gmpfloat<PREC>& g) {
+    mpf_init2(mpf, PREC);
+    mpf_set(mpf, g.mpf);
+  }
 
   gmpfloat(gmpfloat<PREC>&& g) {
     *mpf = *g.mpf;
@@ -36,10 +40,7 @@ class gmpfloat {
   ~gmpfloat<PREC>() { mpf_clear(mpf); }
 
   gmpfloat& operator=(const gmpfloat<PREC>& b) {
-    if (this != &b) {
-      mpf_clear(mpf);
-      mpf_init_set(mpf, b.mpf);
-    }
+    if (this != &b) mpf_set(mpf, b.mpf);
     return *this;
   }
 
@@ -0,0 +1,167 @@
+/**
+ * @file jobqueue.hpp
+ *
+ * Queue of numbered jobs for the rendering workers.
+ */
+
+#ifndef _jobqueue_hpp
+#define _jobqueue_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * Queue handing out the job numbers 0..count-1 of a batch to the workers.
+ *
+ * The generation, next job and job count are packed into a single atomic
+ * word, so taking a job is a single compare-and-swap and cancelling all
+ * remaining jobs of a batch is O(1): it bumps the generation and empties the
+ * batch. The mutex and condition variables are only used to sleep when there
+ * is nothing to do.
+ */
+class job_queue {
+ public:
+  /// A job number and the generation of the batch it belongs to
+  struct job {
+    unsigned int generation;
+    int index;
+  };
+
+  /// Replace any remaining jobs with the jobs 0..count-1 of a new generation
+  void start(int count) {
+    std::uint64_t s = state.load();
+    while (!state.compare_exchange_weak(
+        s, pack(generation_of(s) + 1, 0, count))) {
+    }
+    wake_workers();
+  }
+
+  /**
+   * Drop remaining jobs. Jobs already taken continue, but can detect the
+   * cancel by comparing their generation with generation().
+   */
+  void cancel() {
+    std::uint64_t s = state.load();
+    while (!state.compare_exchange_weak(s, pack(generation_of(s) + 1, 0, 0))) {
+    }
+  }
+
+  /// Generation of the current batch
+  unsigned int generation() const {
+    return generation_of(state.load(std::memory_order_relaxed));
+  }
+
+  /**
+   * Generation the next call to start() will use. Only meaningful when
+   * start() and cancel() are called from a single thread.
+   */
+  unsigned int next_generation() const {
+    return generation_of(pack(generation() + 1, 0, 0));
+  }
+
+  /**
+   * Take the next job, waiting for one if none are queued. Returns false when
+   * the queue is stopped. Every job taken must be followed by finish().
+   */
+  bool take(job &j) {
+    active.fetch_add(1);
+    std::uint64_t s = state.load();
+    while (!stopped) {
+      if (next_of(s) < count_of(s)) {
+        if (state.compare_exchange_weak(s, s + NEXT_ONE)) {
+          j = job{generation_of(s), int(next_of(s))};
+          return true;
+        }
+        continue;
+      }
+      // Not active while sleeping, so wait_idle() does not wait for us
+      finish();
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        ++sleepers;
+        while (state.load() == s && !stopped) work_cv.wait(lock);
+        --sleepers;
+      }
+      active.fetch_add(1);
+      s = state.load();
+    }
+    finish();
+    return false;
+  }
+
+  /// Mark a job taken with take() as done
+  void finish() {
+    if (active.fetch_sub(1) == 1 && idle_waiters > 0) {
+      std::lock_guard<std::mutex> lock(mtx);
+      idle_cv.notify_all();
+    }
+  }
+
+  /// Wait until no jobs are in progress
+  void wait_idle() {
+    std::unique_lock<std::mutex> lock(mtx);
+    ++idle_waiters;
+    while (active.load() != 0) idle_cv.wait(lock);
+    --idle_waiters;
+  }
+
+  /// Wait until all jobs of the current batch are taken and done
+  void wait_done() {
+    std::unique_lock<std::mutex> lock(mtx);
+    ++idle_waiters;
+    while (true) {
+      const std::uint64_t s = state.load();
+      if (active.load() == 0 && next_of(s) == count_of(s)) break;
+      idle_cv.wait(lock);
+    }
+    --idle_waiters;
+  }
+
+  /// Make all current and future calls to take() return false
+  void stop() {
+    stopped = true;
+    wake_workers();
+  }
+
+  /// Undo stop() once all workers have exited
+  void restart() { stopped = false; }
+
+ private:
+  // Layout of the state word: generation:24, next:20, count:20
+  static const int COUNT_BITS = 20;
+  static const std::uint64_t COUNT_MASK = (1u << COUNT_BITS) - 1;
+  static const std::uint64_t NEXT_ONE = std::uint64_t(1) << COUNT_BITS;
+
+  static std::uint64_t pack(unsigned int generation, unsigned int next,
+                            unsigned int count) {
+    return (std::uint64_t(generation & 0xffffff) << (2 * COUNT_BITS)) |
+           (std::uint64_t(next) << COUNT_BITS) | count;
+  }
+  static unsigned int generation_of(std::uint64_t s) {
+    return s >> (2 * COUNT_BITS);
+  }
+  static unsigned int next_of(std::uint64_t s) {
+    return (s >> COUNT_BITS) & COUNT_MASK;
+  }
+  static unsigned int count_of(std::uint64_t s) { return s & COUNT_MASK; }
+
+  void wake_workers() {
+    if (sleepers > 0) {
+      std::lock_guard<std::mutex> lock(mtx);
+      work_cv.notify_all();
+    }
+  }
+
+  std::atomic<std::uint64_t> state{0};
+  std::atomic_int active{0};
+  std::atomic_int sleepers{0};
+  std::atomic_int idle_waiters{0};
+  std::atomic_bool stopped{false};
+  std::mutex mtx;
+  std::condition_variable work_cv;
+  std::condition_variable idle_cv;
+};
+
+#endif  // _jobqueue_hpp
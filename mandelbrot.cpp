@@ -29,11 +29,11 @@
 #include "doubledouble.hpp"
 #include "float.hpp"
 #include "mandelbrot.hpp"
-#include "semaphore.hpp"
 #include "strop.hpp"
 #include "typenames.hpp"
 
 #include "application.hpp"
+#include "render.hpp"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -50,79 +50,46 @@ static std::mutex log_mutex;
 #define LOG(x)
 #endif
 
-
-// /**
-//  * Position as stored in bookmarks
-//  */
-// struct pos {
-//   flt x;
-//   flt y;
-//   flt s;
-// };
-
-// struct pos saves[10];
-
-// /**
-//  * Load bookmarks
-//  */
-// void load() {
-//   std::ifstream inf("bookmarks");
-//   if (inf) {
-//     if (inf.read(reinterpret_cast<char *>(&saves), sizeof(saves))) {
-//     }
-//   }
-// }
-
-// /**
-//  * Save bookmark
-//  */
-// void save(int slot) {
-//   load();
-//   saves[slot] = pos{center_x, center_y, screen_size};
-//   std::ofstream of("bookmarks");
-//   if (of) {
-//     if (of.write(reinterpret_cast<const char *>(&saves), sizeof(saves))) {
-//     }
-//   }
-// }
-
-// /**
-//  * Load bookmark
-//  */
-// void load(int slot) {
-//   load();
-//   center_x = saves[slot].x;
-//   center_y = saves[slot].y;
-//   screen_size = saves[slot].s;
-// }
+/**
+ * Parse command line options
+ */
+static render_options parse_options(int argc, char **argv) {
+  render_options options;
+  // The explorer previews in blocks of 4 pixels unless told otherwise
+  options.coarse_block = 4;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--threads" && i + 1 < argc) {
+      options.threads = std::stoi(argv[++i]);
+    } else if (arg == "--pin") {
+      options.pin = true;
+    } else if (arg == "--idle") {
+      options.idle = true;
+    } else if (arg == "--stats" && i + 1 < argc) {
+      options.stats_file = argv[++i];
+    } else if (arg == "--trace" && i + 1 < argc) {
+      options.trace_file = argv[++i];
+    } else if (arg == "--align-symmetry") {
+      options.align_symmetry = true;
+    } else if (arg == "--coarse" && i + 1 < argc) {
+      options.coarse_block = std::stoi(argv[++i]);
+    } else if (arg == "--calibration" && i + 1 < argc) {
+      options.calibration_file = argv[++i];
+    } else {
+      throw std::runtime_error(
+          "usage: " + std::string(argv[0]) +
+          " [--threads N] [--pin] [--idle] [--stats FILE]"
+          " [--trace FILE] [--align-symmetry] [--coarse N]"
+          " [--calibration FILE]");
+    }
+  }
+  return options;
+}
 
 int main(int argc, char **argv) {
-  (void)argc;
-  (void)argv;
-
   try {
-    mandelbrot_application app;
+    mandelbrot_application app(parse_options(argc, argv));
     app.run();
-
-    for (int i = 0; i < 10; ++i) {
-      // mp_exp_t exp;
-      // mpf_init2(saves[i].x.mpf, 256);
-      // mpf_set_d(saves[i].x.mpf, 3.14159265);
-      // char *str = mpf_get_str(0, &exp, 10, 0, saves[i].x.mpf);
-      // std::cout << i << "," << str << "," << exp << std::endl;
-      // int exp;
-      // std::frexp(saves[i].x, &exp);
-      // printf("%d %.36f\n", i, (double)saves[i].x);
-      // std::cout << float2string(saves[i].x) << " " <<
-      // float2string(saves[i].y) << " " << float2string(saves[i].s) <<
-      // std::endl;
-
-      // char str[256];
-      // __float128 f = 3.141592653;
-      // auto r = quadmath_snprintf(str, 256, "%.20Qe", f);
-      // std::cout << "result=" << r << std::endl;
-      // std::cout << str << std::endl;
-    }
     return EXIT_SUCCESS;
   } catch (const std::exception &exc) {
     std::cerr << exc.what() << std::endl;
@@ -9,7 +9,9 @@
 #ifndef _mandelbrot_hpp
 #define _mandelbrot_hpp
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
 #include "floatext.hpp"
 
@@ -60,37 +62,321 @@ struct iter_result {
   unsigned int iterations;
   FLT x;
   FLT y;
+  /**
+   * Estimated distance from the point to the set, in the units of the
+   * coordinates. Only computed by iter_de(), for escaped points.
+   */
+  double distance = 0.0;
 };
 
+/**
+ * Orbit of a point that did not escape, saved to continue it later with a
+ * higher limit instead of iterating from the start again.
+ */
+template <typename FLT>
+struct iter_state {
+  FLT x{0};
+  FLT y{0};
+  /// Iterations counted when the orbit reached x,y
+  unsigned int iterations = 0;
+  /// Known to be inside the set, without iterating
+  bool inside = false;
+};
+
+/**
+ * Iterations per escape check in iter_continue(). Once an orbit has left the
+ * disc of radius 2 it never returns, so escape can be checked once per block
+ * of iterations, and a block in which the orbit escaped is iterated again
+ * one iteration at a time. Orbits overflowing to infinity or NaN in the
+ * block also fail the check. The sizes are measured with benchmark.cpp: the
+ * check is expensive relative to an iteration of __float128 and of
+ * doubledouble<float>, <double> and <__float128>, and only a little for
+ * float and double. Blocks are slower for long double and for the
+ * doubledouble types built on it, and for the multiple precision types,
+ * whose state is expensive to copy.
+ */
+template <typename FLT>
+struct escape_block {
+  static constexpr unsigned int size = 1;
+};
+template <>
+struct escape_block<float> {
+  static constexpr unsigned int size = 8;
+};
+template <>
+struct escape_block<double> {
+  static constexpr unsigned int size = 8;
+};
+template <>
+struct escape_block<__float128> {
+  static constexpr unsigned int size = 8;
+};
+template <>
+struct escape_block<doubledouble<float>> {
+  static constexpr unsigned int size = 8;
+};
+template <>
+struct escape_block<doubledouble<double>> {
+  static constexpr unsigned int size = 8;
+};
+template <>
+struct escape_block<doubledouble<__float128>> {
+  static constexpr unsigned int size = 8;
+};
+
+/**
+ * Continue the orbit of xc,yc from a saved state, up to limit, which must be
+ * higher than the iterations of the state. If the point still does not
+ * escape, its new state is stored in *stopped, if given. BLOCK is the number
+ * of iterations per escape check.
+ */
+template <typename FLT, unsigned int BLOCK = escape_block<FLT>::size>
+iter_result<FLT> iter_continue(FLT xc, FLT yc, const iter_state<FLT> &state,
+                               unsigned int limit,
+                               iter_state<FLT> *stopped = nullptr) {
+  FLT x = state.x;
+  FLT y = state.y;
+  unsigned int iterations = state.iterations;
+  FLT x2 = x * x;
+  FLT y2 = y * y;
+  // Constants of the type, so the loop needs no conversions
+  const FLT two(2.0);
+  const FLT four(4.0);
+
+  if constexpr (BLOCK > 1) {
+    while (iterations + BLOCK < limit) {
+      const FLT bx = x, by = y, bx2 = x2, by2 = y2;
+      for (unsigned int i = 0; i < BLOCK; ++i) {
+        y = x * y * two + yc;
+        x = x2 - y2 + xc;
+        x2 = x * x;
+        y2 = y * y;
+      }
+      if (!(x2 + y2 < four)) {
+        // Escaped within the block, find where below
+        x = bx;
+        y = by;
+        x2 = bx2;
+        y2 = by2;
+        break;
+      }
+      iterations += BLOCK;
+    }
+  }
+
+  while (x2 + y2 < four && ++iterations < limit) {
+    y = x * y * two + yc;
+    x = x2 - y2 + xc;
+    x2 = x * x;
+    y2 = y * y;
+  }
+  // The last increment of the loop did not iterate
+  if (stopped && iterations == limit)
+    *stopped = {x, y, iterations - 1, false};
+
+  for (int j = 0; j < 4; ++j) {
+    y = x * y * two + yc;
+    x = x2 - y2 + xc;
+    x2 = x * x;
+    y2 = y * y;
+  }
+
+  return {iterations, x2, y2};
+}
+
 /**
  * Perform mandelbrot iterations and return the number of iteration required
- * before escape.
+ * before escape, or limit if the point did not escape. The state of a point
+ * that did not escape is stored in *stopped, if given.
+ */
+template <typename FLT, unsigned int BLOCK = escape_block<FLT>::size>
+iter_result<FLT> iter(FLT xc, FLT yc, unsigned int limit = LIMIT,
+                      iter_state<FLT> *stopped = nullptr) {
+  if (isinside(xc, yc)) {
+    if (stopped) *stopped = {FLT(0), FLT(0), 0, true};
+    return {limit, FLT(0), FLT(0)};
+  }
+  return iter_continue<FLT, BLOCK>(xc, yc, {xc, yc, 0, false}, limit,
+                                   stopped);
+}
+
+/// Longest cycle searched for in the orbit of a point inside the set
+static const unsigned int max_cycle_period = 64;
+/// Most Newton steps to find a cycle of a point
+static const int cycle_newton_steps = 8;
+
+/**
+ * An attracting cycle of the iteration. The points of a component of the set
+ * share the period of their cycle, and the cycle moves little between
+ * neighboring points, so a cycle found for one point is a good start for
+ * its neighbors.
+ */
+template <typename FLT>
+struct interior_cycle {
+  unsigned int period = 0; /**< 0 if no cycle is known */
+  FLT x{0};                /**< A point of the cycle */
+  FLT y{0};
+};
+
+/**
+ * Check if xc,yc has an attracting cycle of the period of cycle, by refining
+ * the point of cycle with Newton's method until it is a periodic point, and
+ * checking that its multiplier is less than one. A point with an attracting
+ * cycle is inside the set. On success cycle is moved to the cycle of xc,yc.
+ * The derivatives only need a few digits, so they are kept in double.
  */
 template <typename FLT>
-iter_result<FLT> iter(FLT xc, FLT yc) {
+bool attracting_cycle(FLT xc, FLT yc, interior_cycle<FLT> &cycle) {
+  if (cycle.period == 0) return false;
+  const double tolerance =
+      std::max(1e-12, 64 * get_double(std::numeric_limits<FLT>::epsilon()));
+  FLT x = cycle.x;
+  FLT y = cycle.y;
+  for (int step = 0; step < cycle_newton_steps; ++step) {
+    FLT zx = x;
+    FLT zy = y;
+    double dx = 1.0;
+    double dy = 0.0;
+    for (unsigned int i = 0; i < cycle.period; ++i) {
+      // d/dz of z^2 + c is 2 z
+      const double zxd = get_double(zx);
+      const double zyd = get_double(zy);
+      const double ndx = 2.0 * (zxd * dx - zyd * dy);
+      dy = 2.0 * (zxd * dy + zyd * dx);
+      dx = ndx;
+      const FLT x2 = zx * zx;
+      const FLT y2 = zy * zy;
+      if (x2 + y2 > 4.0) return false;
+      zy = zx * zy * FLT(2.0) + yc;
+      zx = x2 - y2 + xc;
+    }
+    // Newton step for f(z) - z = 0, dividing by f'(z) - 1
+    const double ax = dx - 1.0;
+    const double ay = dy;
+    const double a2 = ax * ax + ay * ay;
+    if (a2 == 0.0) return false;
+    const FLT ix = FLT(ax / a2);
+    const FLT iy = FLT(-ay / a2);
+    const FLT gx = zx - x;
+    const FLT gy = zy - y;
+    const FLT sx = gx * ix - gy * iy;
+    const FLT sy = gx * iy + gy * ix;
+    x -= sx;
+    y -= sy;
+    if (get_double(sx * sx + sy * sy) < tolerance * tolerance) {
+      if (dx * dx + dy * dy >= 1.0) return false;
+      cycle.x = x;
+      cycle.y = y;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Find the attracting cycle of xc,yc from the state of its orbit when it
+ * reached the limit, which is then close to the cycle. The period is taken
+ * from the closest return of the orbit. Sets the period of cycle to 0 if no
+ * attracting cycle is found.
+ */
+template <typename FLT>
+bool find_cycle(FLT xc, FLT yc, const iter_state<FLT> &state,
+                interior_cycle<FLT> &cycle) {
+  cycle = interior_cycle<FLT>();
+  if (state.inside) return false;
+  FLT x = state.x;
+  FLT y = state.y;
+  double closest = std::numeric_limits<double>::infinity();
+  unsigned int period = 0;
+  for (unsigned int i = 1; i <= max_cycle_period; ++i) {
+    const FLT nx = x * x - y * y + xc;
+    y = x * y * FLT(2.0) + yc;
+    x = nx;
+    const FLT ex = x - state.x;
+    const FLT ey = y - state.y;
+    const double distance = get_double(ex * ex + ey * ey);
+    if (distance < closest) {
+      closest = distance;
+      period = i;
+    }
+  }
+  cycle.period = period;
+  cycle.x = state.x;
+  cycle.y = state.y;
+  if (attracting_cycle(xc, yc, cycle)) return true;
+  cycle.period = 0;
+  return false;
+}
+
+/**
+ * Generalization of isinside(x, y) beyond the cardioid and the period 2
+ * bulb: also inside if x,y has the attracting cycle found for a neighbor.
+ */
+template <typename FLT>
+bool isinside(FLT x, FLT y, interior_cycle<FLT> &cycle) {
+  return isinside(x, y) || attracting_cycle(x, y, cycle);
+}
+
+/**
+ * Like iter(), but also track the derivative dz/dc to estimate the distance
+ * to the set. The derivative only needs a few digits, so it is kept in double
+ * whatever the precision of the coordinates.
+ */
+template <typename FLT>
+iter_result<FLT> iter_de(FLT xc, FLT yc, unsigned int limit = LIMIT) {
   FLT x = xc;
   FLT y = yc;
-  if (isinside(xc, yc)) return {LIMIT, FLT(0), FLT(0)};
+  if (isinside(xc, yc)) return {limit, FLT(0), FLT(0)};
 
   unsigned int iterations = 0;
   FLT x2 = x * x;
   FLT y2 = y * y;
+  double dx = 1.0;
+  double dy = 0.0;
 
-  while (x2 + y2 < 4.0 && ++iterations < LIMIT) {
+  // dz/dc of z^2 + c is 2 z dz/dc + 1
+  auto derive = [&](double zx, double zy) {
+    const double ndx = 2.0 * (zx * dx - zy * dy) + 1.0;
+    dy = 2.0 * (zx * dy + zy * dx);
+    dx = ndx;
+  };
+
+  while (x2 + y2 < 4.0 && ++iterations < limit) {
+    derive(get_double(x), get_double(y));
     y = x * y * FLT(2.0) + yc;
     x = x2 - y2 + xc;
     x2 = x * x;
     y2 = y * y;
   }
+  if (iterations == limit) return {limit, x2, y2};
 
   for (int j = 0; j < 4; ++j) {
+    derive(get_double(x), get_double(y));
     y = x * y * FLT(2) + yc;
     x = x2 - y2 + xc;
     x2 = x * x;
     y2 = y * y;
   }
 
-  return {iterations, x2, y2};
+  // The estimate needs a much larger escape radius than the coloring. The
+  // orbit has escaped, so double is precise enough to continue.
+  const double cx = get_double(xc);
+  const double cy = get_double(yc);
+  double zx = get_double(x);
+  double zy = get_double(y);
+  for (int j = 0; j < 64 && zx * zx + zy * zy < 1e20; ++j) {
+    derive(zx, zy);
+    const double nzx = zx * zx - zy * zy + cx;
+    zy = 2.0 * zx * zy + cy;
+    zx = nzx;
+  }
+
+  // Milnor's estimate. Close to the set it is within a factor of four of the
+  // true distance.
+  const double r2 = zx * zx + zy * zy;
+  const double distance =
+      std::sqrt(r2) * std::log(r2) / std::sqrt(dx * dx + dy * dy);
+  return {iterations, x2, y2, distance};
 }
 
 template <typename FLT>
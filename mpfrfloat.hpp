@@ -20,15 +20,16 @@ class mpfrfloat {
 
   explicit mpfrfloat(mpfr_t f) { mpfr[0] = f[0]; }
 
-  mpfrfloat(const mpfrfloat& g) { mpfr_init_set(mpfr, g.mpfr, RND); }
+  // mpfr_init_set() would use the default precision of 53 bits
+  mpfrfloat(const mpfrfloat& g) {
+    mpfr_init2(mpfr, PREC);
+    mpfr_set(mpfr, g.mpfr, RND);
+  }
 
   ~mpfrfloat() { mpfr_clear(mpfr); }
 
   mpfrfloat& operator=(const mpfrfloat& b) {
-    if (this != &b) {
-      mpfr_clear(mpfr);
-      mpfr_init_set(mpfr, b.mpfr, RND);
-    }
+    if (this != &b) mpfr_set(mpfr, b.mpfr, RND);
     return *this;
   }
 
@@ -39,7 +40,7 @@ class mpfrfloat {
 
   explicit mpfrfloat(unsigned int i) {
     mpfr_init2(mpfr, PREC);
-    mpfr_init_set_ui(mpfr, i, RND);
+    mpfr_set_ui(mpfr, i, RND);
   }
 
   explicit mpfrfloat(float _f) {
@@ -104,7 +105,11 @@ class mpfrfloat {
 
   template <typename FLT>
   explicit operator doubledouble<FLT>() const {
-    FLT r = FLT(*this);
+    // Round the high part to nearest regardless of RND, so the low part
+    // holds the exact remainder and the result is normalized.
+    mpfrfloat<PREC, MPFR_RNDN> nearest;
+    mpfr_set(nearest.mpfr, mpfr, MPFR_RNDN);
+    FLT r = FLT(nearest);
     FLT e = FLT(*this - mpfrfloat<PREC, RND>(r));
     return doubledouble<FLT>(r, e);
   }
@@ -0,0 +1,143 @@
+#include "netio.hpp"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+static std::runtime_error socket_error(const std::string &what) {
+  return std::runtime_error(what + ": " + strerror(errno));
+}
+
+int listen_unix(const std::string &path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    throw std::runtime_error("socket path too long");
+  std::strcpy(addr.sun_path, path.c_str());
+  // Only a socket is replaced, so a mistyped path never deletes a file
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode))
+      throw std::runtime_error(path + ": exists and is not a socket");
+    if (unlink(path.c_str()) < 0) throw socket_error(path);
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) throw socket_error("socket");
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    auto error = socket_error(path);
+    close(fd);
+    throw error;
+  }
+  return fd;
+}
+
+int listen_tcp(int port) {
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) throw socket_error("socket");
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    auto error = socket_error("port " + std::to_string(port));
+    close(fd);
+    throw error;
+  }
+  return fd;
+}
+
+int local_port(int fd) {
+  sockaddr_in addr{};
+  socklen_t length = sizeof(addr);
+  if (getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &length) < 0)
+    throw socket_error("getsockname");
+  return ntohs(addr.sin_port);
+}
+
+int connect_tcp(const std::string &address) {
+  const size_t colon = address.rfind(':');
+  if (colon == std::string::npos)
+    throw std::runtime_error("expected host:port, got " + address);
+  const std::string host = address.substr(0, colon);
+  const std::string port = address.substr(colon + 1);
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *info = nullptr;
+  int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &info);
+  if (rc != 0)
+    throw std::runtime_error(address + ": " + std::string(gai_strerror(rc)));
+  int fd = -1;
+  for (addrinfo *ai = info; ai && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(info);
+  if (fd < 0) throw socket_error(address);
+  return fd;
+}
+
+bool write_all(int fd, const void *data, size_t length) {
+  const char *p = static_cast<const char *>(data);
+  while (length > 0) {
+    ssize_t n = send(fd, p, length, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    length -= n;
+  }
+  return true;
+}
+
+bool socket_reader::fill() {
+  char chunk[4096];
+  ssize_t n;
+  do {
+    n = read(fd, chunk, sizeof(chunk));
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) return false;
+  buffer.append(chunk, n);
+  return true;
+}
+
+bool socket_reader::read_line(std::string &line) {
+  size_t newline;
+  while ((newline = buffer.find('\n')) == std::string::npos) {
+    if (buffer.size() > max_line || !fill()) return false;
+  }
+  line = buffer.substr(0, newline);
+  buffer.erase(0, newline + 1);
+  return true;
+}
+
+bool socket_reader::read_bytes(void *data, size_t length) {
+  char *p = static_cast<char *>(data);
+  const size_t buffered = std::min(length, buffer.size());
+  std::memcpy(p, buffer.data(), buffered);
+  buffer.erase(0, buffered);
+  p += buffered;
+  length -= buffered;
+  while (length > 0) {
+    ssize_t n = read(fd, p, length);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    length -= n;
+  }
+  return true;
+}
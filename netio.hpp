@@ -0,0 +1,55 @@
+/**
+ * @file netio.hpp
+ *
+ * Blocking socket helpers for the render server and distributed rendering.
+ * Errors opening sockets throw std::runtime_error; errors on an open
+ * connection are returned, since a client going away is not exceptional.
+ */
+
+#ifndef _netio_hpp
+#define _netio_hpp
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Listen on a Unix socket, replacing a stale socket file. Throws if the path
+ * exists and is not a socket.
+ */
+int listen_unix(const std::string &path);
+
+/// Listen on a TCP port on all interfaces. Port 0 picks a free port.
+int listen_tcp(int port);
+
+/// Port a listening TCP socket is bound to
+int local_port(int fd);
+
+/// Connect to a TCP server, given as "host:port"
+int connect_tcp(const std::string &address);
+
+/// Write all of a buffer. Returns false if the peer went away.
+bool write_all(int fd, const void *data, size_t length);
+
+/// Buffered reading of lines and binary data from a socket
+class socket_reader {
+ public:
+  explicit socket_reader(int fd) : fd(fd) {}
+
+  /**
+   * Read a line without the newline. Returns false at end of file, on error
+   * or if the line is longer than max_line.
+   */
+  bool read_line(std::string &line);
+
+  /// Read exactly length bytes. Returns false at end of file or on error.
+  bool read_bytes(void *data, size_t length);
+
+ private:
+  static const size_t max_line = 4096;
+  bool fill();
+
+  int fd;
+  std::string buffer;
+};
+
+#endif  // _netio_hpp
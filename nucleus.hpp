@@ -0,0 +1,191 @@
+/**
+ * @file nucleus.hpp
+ *
+ * Finding minibrots. Every minibrot is a small copy of the whole set around
+ * its nucleus, the point c where 0 is periodic, with the period of the
+ * minibrot. The nucleus is found with Newton's method and the size of the
+ * minibrot estimated from the orbit, in any float type, so a target at any
+ * depth costs a few evaluations of the orbit instead of exploratory renders.
+ */
+
+#ifndef _nucleus_hpp
+#define _nucleus_hpp
+
+#include <cmath>
+#include <limits>
+
+#include "mandelbrot.hpp"
+
+/// Longest period searched for
+static const unsigned int max_minibrot_period = 1 << 20;
+/// Most Newton steps to find a nucleus
+static const int nucleus_newton_steps = 64;
+
+/**
+ * A minibrot. Its points are approximately those of the whole set,
+ * multiplied by the complex scale and added to the nucleus.
+ */
+template <typename FLT>
+struct minibrot {
+  FLT x{0}; /**< Nucleus */
+  FLT y{0};
+  unsigned int period = 0;
+  FLT scale_x{1};
+  FLT scale_y{0};
+};
+
+/**
+ * Lowest period of a minibrot within radius of x,y: the first iteration at
+ * which the image of the disc of radius around x,y contains 0, estimated by
+ * the derivative of the orbit. Returns 0 if there is none up to max_period.
+ */
+template <typename FLT>
+unsigned int find_period(const FLT &x, const FLT &y, const FLT &radius,
+                         unsigned int max_period = max_minibrot_period) {
+  FLT zx{0}, zy{0};
+  FLT dx{0}, dy{0};
+  const FLT r2 = radius * radius;
+  for (unsigned int i = 1; i <= max_period; ++i) {
+    // dz/dc of z^2 + c is 2 z dz/dc + 1
+    const FLT ndx = FLT(2.0) * (zx * dx - zy * dy) + FLT(1.0);
+    dy = FLT(2.0) * (zx * dy + zy * dx);
+    dx = ndx;
+    const FLT nzx = zx * zx - zy * zy + x;
+    zy = FLT(2.0) * zx * zy + y;
+    zx = nzx;
+    const FLT z2 = zx * zx + zy * zy;
+    if (z2 > 4.0) return 0;
+    if (z2 < r2 * (dx * dx + dy * dy)) return i;
+  }
+  return 0;
+}
+
+/**
+ * Move x,y to a nucleus of the period with Newton's method on the orbit of 0
+ * returning to 0. This may also be a nucleus of a period that divides the
+ * period; the period is then reduced to it. Returns false if Newton's method
+ * did not converge.
+ */
+template <typename FLT>
+bool find_nucleus(FLT &x, FLT &y, unsigned int &period) {
+  const FLT eps = std::numeric_limits<FLT>::epsilon();
+  for (int step = 0; step < nucleus_newton_steps; ++step) {
+    FLT zx{0}, zy{0};
+    FLT dx{0}, dy{0};
+    for (unsigned int i = 0; i < period; ++i) {
+      const FLT ndx = FLT(2.0) * (zx * dx - zy * dy) + FLT(1.0);
+      dy = FLT(2.0) * (zx * dy + zy * dx);
+      dx = ndx;
+      const FLT nzx = zx * zx - zy * zy + x;
+      zy = FLT(2.0) * zx * zy + y;
+      zx = nzx;
+    }
+    // Newton step z / dz/dc
+    const FLT d2 = dx * dx + dy * dy;
+    if (!(d2 > 0.0)) return false;
+    const FLT sx = (zx * dx + zy * dy) / d2;
+    const FLT sy = (zy * dx - zx * dy) / d2;
+    x -= sx;
+    y -= sy;
+    const FLT tolerance2 = FLT(256.0) * eps * eps * (x * x + y * y);
+    if (!(sx * sx + sy * sy > tolerance2)) {
+      // The orbit of a nucleus of a divisor returns to 0 earlier, within
+      // the same tolerance
+      zx = FLT(0);
+      zy = FLT(0);
+      dx = FLT(0);
+      dy = FLT(0);
+      for (unsigned int i = 1; i < period; ++i) {
+        const FLT ndx = FLT(2.0) * (zx * dx - zy * dy) + FLT(1.0);
+        dy = FLT(2.0) * (zx * dy + zy * dx);
+        dx = ndx;
+        const FLT nzx = zx * zx - zy * zy + x;
+        zy = FLT(2.0) * zx * zy + y;
+        zx = nzx;
+        if (period % i == 0 && zx * zx + zy * zy < FLT(256.0) * tolerance2 *
+                                                         (dx * dx + dy * dy)) {
+          period = i;
+          break;
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Complex scale of the minibrot of a nucleus:
+ * 1 / (b l^2), where l is the derivative dz/dz of the orbit of 0 up to the
+ * last iteration before it returns, and b the sum of the reciprocals of the
+ * derivative along the way.
+ */
+template <typename FLT>
+void nucleus_scale(minibrot<FLT> &m) {
+  FLT zx{0}, zy{0};
+  FLT lx{1}, ly{0};
+  FLT bx{1}, by{0};
+  for (unsigned int i = 1; i < m.period; ++i) {
+    const FLT nzx = zx * zx - zy * zy + m.x;
+    zy = FLT(2.0) * zx * zy + m.y;
+    zx = nzx;
+    const FLT nlx = FLT(2.0) * (zx * lx - zy * ly);
+    ly = FLT(2.0) * (zx * ly + zy * lx);
+    lx = nlx;
+    const FLT l2 = lx * lx + ly * ly;
+    bx += lx / l2;
+    by -= ly / l2;
+  }
+  // d = b l^2, scale = 1 / d
+  const FLT sqx = lx * lx - ly * ly;
+  const FLT sqy = FLT(2.0) * lx * ly;
+  const FLT ddx = bx * sqx - by * sqy;
+  const FLT ddy = bx * sqy + by * sqx;
+  const FLT d2 = ddx * ddx + ddy * ddy;
+  m.scale_x = ddx / d2;
+  m.scale_y = FLT(0) - ddy / d2;
+}
+
+/**
+ * Find the minibrot of the period closest to x,y, or if period is 0, the
+ * one of the lowest period within radius of x,y. Returns false if none was
+ * found.
+ */
+template <typename FLT>
+bool find_minibrot(const FLT &x, const FLT &y, const FLT &radius,
+                   unsigned int period, minibrot<FLT> &m) {
+  if (period == 0) period = find_period(x, y, radius);
+  if (period == 0) return false;
+  m.x = x;
+  m.y = y;
+  if (!find_nucleus(m.x, m.y, period)) return false;
+  m.period = period;
+  nucleus_scale(m);
+  return true;
+}
+
+/// Size of a minibrot relative to the whole set, the magnitude of its scale
+template <typename FLT>
+FLT minibrot_size(const minibrot<FLT> &m) {
+  // Without a square root of FLT, and without leaving the range of FLT
+  const FLT ax = std::abs(m.scale_x);
+  const FLT ay = std::abs(m.scale_y);
+  const FLT large = ax > ay ? ax : ay;
+  if (!(large > 0.0)) return large;
+  const double ratio = get_double((ax > ay ? ay : ax) / large);
+  return large * FLT(std::sqrt(1.0 + ratio * ratio));
+}
+
+/**
+ * View framing a minibrot like the view centered at -0.6 with size 2 frames
+ * the whole set, with a margin for minibrots that are rotated.
+ */
+template <typename FLT>
+void frame_minibrot(const minibrot<FLT> &m, FLT &center_x, FLT &center_y,
+                    FLT &size) {
+  center_x = m.x + FLT(-0.6) * m.scale_x;
+  center_y = m.y + FLT(-0.6) * m.scale_y;
+  size = FLT(2.5) * minibrot_size(m);
+}
+
+#endif  // _nucleus_hpp
@@ -41,3 +41,30 @@ palette::palette() {
     pal[i] = hsv2rgb(h, s, v);
   }
 }
+
+uint32_t palette::color(double sum) const {
+  unsigned int n = (unsigned int)floor(sum);
+  double f2 = sum - double(n);
+  unsigned int n1 = n % 256;
+  double f1 = 1.0 - f2;
+  unsigned int n2 = ((n1 + 1) % 256);
+  return blend(pal[n1], pal[n2], f1);
+}
+
+uint32_t blend(uint32_t c1, uint32_t c2, float f) {
+  uint8_t r1 = c1 >> 24;
+  uint8_t g1 = (c1 >> 16) & 0xff;
+  uint8_t b1 = (c1 >> 8) & 0xff;
+  uint8_t a1 = (c1)&0xff;
+  uint8_t r2 = c2 >> 24;
+  uint8_t g2 = (c2 >> 16) & 0xff;
+  uint8_t b2 = (c2 >> 8) & 0xff;
+  uint8_t a2 = (c2)&0xff;
+  int s1 = 255 * f;
+  int s2 = 255 - s1;
+  uint8_t r3 = (r1 * s1 + r2 * s2) / 256;
+  uint8_t g3 = (g1 * s1 + g2 * s2) / 256;
+  uint8_t b3 = (b1 * s1 + b2 * s2) / 256;
+  uint8_t a3 = (a1 * s1 + a2 * s2) / 256;
+  return (r3 << 24) | (g3 << 16) | (b3 << 8) | (a3);
+}
@@ -11,7 +11,12 @@ class palette {
  public:
   uint32_t pal[256];
   palette();
-  uint32_t operator[](size_t i) { return pal[i]; }
+  uint32_t operator[](size_t i) const { return pal[i]; }
+  /// Color of an escaped point from its smooth iteration count
+  uint32_t color(double sum) const;
 };
 
+/// Blend two colors by fraction of each.
+uint32_t blend(uint32_t c1, uint32_t c2, float f);
+
 #endif  // _palette_hpp
@@ -0,0 +1,488 @@
+/**
+ * @file regression.cpp
+ *
+ * Regression test of the rendered images. Renders a set of reference
+ * viewports through the render engine without a window and compares the
+ * iteration fields against golden data stored in the repository, and
+ * cross-checks every float type precise enough for a viewport against an
+ * independent mpfrfloat reference. All viewports are also rendered at once as
+ * concurrent render_jobs, and through render_jobs whose limit is raised in
+ * steps, which must match the same golden data. Last, the displayed frame
+ * is checked to be reprojected when the view changes.
+ *
+ * Run with --update to regenerate the golden data after an intended change
+ * of the images.
+ */
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The float types must be declared before mandelbrot.hpp uses std::abs
+#include "doubledouble.hpp"
+#include "mpfrfloat.hpp"
+
+#include "calibration.hpp"
+#include "floatdispatch.hpp"
+#include "mandelbrot.hpp"
+#include "render.hpp"
+#include "renderjob.hpp"
+#include "strop.hpp"
+
+/// Size of the rendered images
+static const int width = 48;
+static const int height = 36;
+
+/// A reference view of the set
+struct viewport {
+  const char *name;
+  const char *x;
+  const char *y;
+  const char *size;
+};
+
+static const viewport viewports[] = {
+    {"whole", "-0.6", "0", "2.0"},
+    {"seahorse", "-0.7436438870371587", "0.1318259042053119", "1e-3"},
+    {"elephant", "0.2850", "0.0110", "0.01"},
+    {"real-axis", "-1.7590", "0", "0.02"},
+    {"deep", "-0.743643887037158704752191506114774",
+     "0.131825904205311970493132056385139", "1e-20"},
+    {"near-origin", "0.33779087587172", "0.044043336266838", "1e-14"},
+};
+
+/**
+ * Allowed difference between two iteration fields. Pixels differ if one is
+ * inside the set and the other is not, or if their smooth iteration counts
+ * differ by more than max_difference.
+ */
+struct tolerance {
+  double max_difference;
+  double max_differing_fraction; /**< Of all pixels */
+};
+
+/// Renders must match their golden data
+static const tolerance golden_tolerance{0.01, 0.0};
+/**
+ * Types against the reference. Near the boundary orbits are chaotic and any
+ * rounding difference eventually changes the escape time, so a few pixels
+ * may differ even between types that are all precise enough.
+ */
+static const tolerance cross_check_tolerance{0.5, 0.02};
+/**
+ * Types are only cross-checked where their epsilon is this much smaller
+ * than the pixel size. The engine selects types with less margin, but the
+ * escape times of chaotic orbits then legitimately differ from the
+ * reference.
+ */
+static const double cross_check_margin = 65536;
+
+/// Types with golden data, and the name used in the file name
+static const std::pair<FloatType, const char *> golden_types[] = {
+    {FT_DOUBLE, "double"},
+    {FT_GMPFLOAT256, "gmpfloat256"},
+};
+
+typedef std::vector<float> field;
+
+static std::string golden_dir = "golden";
+static bool update = false;
+static int failures = 0;
+
+static void set_view(const viewport &v) {
+  std::istringstream(v.x) >> center_x;
+  std::istringstream(v.y) >> center_y;
+  std::istringstream(v.size) >> screen_size;
+}
+
+/// Render the current view through the engine with a single float type
+static field render(FloatType type) {
+  user_chosen_float_type = type;
+  start_render();
+  render_wait();
+  field result(width * height);
+  render_copy_iterations(result.data(), 0, result.size());
+  return result;
+}
+
+/// Convert a coordinate to FLT through its decimal representation
+template <typename FLT>
+static FLT convert(const flt &f) {
+  std::stringstream ss;
+  ss << std::setprecision(std::numeric_limits<flt>::digits10) << f;
+  FLT result;
+  ss >> result;
+  return result;
+}
+
+/**
+ * Iterate the current view directly with FLT, independent of the render
+ * engine, using the same pixel coordinates.
+ */
+template <typename FLT>
+static field reference() {
+  const flt size = screen_size / flt(height);
+  const flt min_x = center_x - width * size / flt(2.0);
+  const flt min_y = center_y - height * size / flt(2.0);
+  field result;
+  for (int row = 0; row < height; ++row) {
+    const FLT y = convert<FLT>(min_y + row * size);
+    for (int col = 0; col < width; ++col) {
+      auto r = iter(convert<FLT>(min_x + col * size), y);
+      result.push_back(r.iterations == LIMIT
+                           ? LIMIT
+                           : float(r.iterations + fraction(r.x, r.y)));
+    }
+  }
+  return result;
+}
+
+/**
+ * True if the type has enough precision for the current view, with a margin.
+ * The same criterion as the automatic type selection of the engine when the
+ * margin is 1.
+ */
+static bool precise_enough(FloatType type, double margin) {
+  const double magnitude =
+      std::max(calibration_min_magnitude,
+               std::abs(get_double(center_x)) + get_double(screen_size));
+  const flt delta = screen_size / flt(height) / flt(magnitude);
+  bool result = false;
+  with_float_type(type, [&](auto tag) {
+    using FLT = typename decltype(tag)::type;
+    result = delta > flt(std::numeric_limits<FLT>::epsilon()) * flt(margin);
+  });
+  return result;
+}
+
+/// Compare two fields and report the result
+static void compare(const std::string &name, const field &actual,
+                    const field &expected, const tolerance &tol) {
+  int differing = 0;
+  double largest = 0.0;
+  for (size_t i = 0; i < actual.size(); ++i) {
+    const bool inside_a = actual[i] == LIMIT;
+    const bool inside_e = expected[i] == LIMIT;
+    const double difference = std::abs(double(actual[i]) - expected[i]);
+    if (inside_a != inside_e || difference > tol.max_difference) {
+      ++differing;
+      if (inside_a == inside_e) largest = std::max(largest, difference);
+    }
+  }
+  const bool ok = differing <= tol.max_differing_fraction * actual.size();
+  if (!ok) ++failures;
+  std::cout << std::left << std::setw(48) << name << std::right
+            << std::setw(6) << differing << " of " << actual.size()
+            << " pixels differ, largest " << std::setprecision(3) << largest
+            << (ok ? "" : "  FAILED") << std::endl;
+}
+
+static std::string golden_path(const viewport &v, const char *type) {
+  return golden_dir + "/" + v.name + "-" + type + ".txt";
+}
+
+/// Write a field as rows of smooth iteration counts
+static void write_golden(const std::string &path, const field &data) {
+  std::ofstream of(path);
+  if (!of) throw std::runtime_error("cannot write " + path);
+  of << width << " " << height << "\n" << std::fixed << std::setprecision(3);
+  for (int row = 0; row < height; ++row) {
+    for (int col = 0; col < width; ++col)
+      of << (col ? " " : "") << data[row * width + col];
+    of << "\n";
+  }
+}
+
+static field read_golden(const std::string &path) {
+  std::ifstream in(path);
+  int golden_width = 0, golden_height = 0;
+  in >> golden_width >> golden_height;
+  if (!in || golden_width != width || golden_height != height)
+    throw std::runtime_error("missing or invalid " + path +
+                             ", regenerate with --update");
+  field data(width * height);
+  for (float &value : data) in >> value;
+  if (!in) throw std::runtime_error("truncated " + path);
+  return data;
+}
+
+static void test_viewport(const viewport &v) {
+  set_view(v);
+  const std::string prefix = std::string(v.name) + "/";
+
+  for (const auto &golden : golden_types) {
+    if (!precise_enough(golden.first, 1)) continue;
+    const std::string path = golden_path(v, golden.second);
+    const field data = render(golden.first);
+    if (update) {
+      write_golden(path, data);
+      std::cout << "wrote " << path << std::endl;
+    } else {
+      compare(prefix + golden.second + " vs golden", data, read_golden(path),
+              golden_tolerance);
+    }
+  }
+  if (update) return;
+
+  const field ref = reference<mpfrfloat<256, MPFR_RNDN>>();
+  for (int type = FT_AUTO + 1; type < FT_MAX; ++type) {
+    if (!precise_enough(FloatType(type), cross_check_margin)) continue;
+    compare(prefix + floattypenames[type] + " vs mpfrfloat<256>",
+            render(FloatType(type)), ref, cross_check_tolerance);
+  }
+}
+
+/**
+ * Render all viewports concurrently on one pool with the library API, using
+ * the most precise golden type so every viewport has golden data.
+ */
+static void test_render_jobs() {
+  const auto &golden = golden_types[std::size(golden_types) - 1];
+  render_pool pool;
+  std::vector<std::unique_ptr<render_job>> render_jobs;
+  for (const auto &v : viewports) {
+    set_view(v);
+    render_jobs.emplace_back(new render_job(pool, width, height));
+    render_jobs.back()->set_view(center_x, center_y, screen_size);
+    render_jobs.back()->set_float_type(golden.first);
+    render_jobs.back()->start();
+  }
+  for (size_t i = 0; i < render_jobs.size(); ++i) {
+    render_job &job = *render_jobs[i];
+    job.wait();
+    const float *data = job.iterations();
+    compare(std::string(viewports[i].name) + "/render_job vs golden",
+            field(data, data + width * height),
+            read_golden(golden_path(viewports[i], golden.second)),
+            golden_tolerance);
+  }
+}
+
+/**
+ * Raising the limit of a complete render_job continues the pixels that
+ * reached the old limit, which must give the same result as rendering with
+ * the final limit at once.
+ */
+static void test_deepening() {
+  const auto &golden = golden_types[std::size(golden_types) - 1];
+  render_pool pool;
+  for (const auto &v : viewports) {
+    set_view(v);
+    render_job job(pool, width, height);
+    job.set_view(center_x, center_y, screen_size);
+    job.set_float_type(golden.first);
+    for (unsigned int limit : {LIMIT / 16, LIMIT / 4, LIMIT}) {
+      job.set_limit(limit);
+      job.start();
+      job.wait();
+    }
+    const float *data = job.iterations();
+    compare(std::string(v.name) + "/deepened render_job vs golden",
+            field(data, data + width * height),
+            read_golden(golden_path(v, golden.second)), golden_tolerance);
+  }
+}
+
+/**
+ * The displayed frame keeps the completed rows of a render, and shows them
+ * reprojected until the rows of the next render are presented. Zooming in
+ * by two around the center shows each pixel of the center of the previous
+ * frame as two by two pixels.
+ */
+static void test_reprojection() {
+  set_view(viewports[0]);
+  user_chosen_float_type = FT_DOUBLE;
+  start_render();
+  render_wait();
+  std::vector<uint32_t> before(width * height);
+  render_copy_pixels(before.data(), 0, before.size() * 4);
+  for (int row = 0; row < height; ++row) render_present_row(row);
+
+  screen_size /= flt(2);
+  start_render();
+  render_wait();
+  std::vector<uint32_t> shown(width * height);
+  render_copy_front(shown.data(), 0, shown.size() * 4);
+  int differing = 0;
+  for (int row = 0; row < height; ++row) {
+    for (int col = 0; col < width; ++col) {
+      const uint32_t expected =
+          before[(height / 4 + row / 2) * width + width / 4 + col / 2];
+      if (shown[row * width + col] != expected) ++differing;
+    }
+  }
+  const bool ok = differing == 0;
+  if (!ok) ++failures;
+  std::cout << std::left << std::setw(48) << "whole/reprojected" << std::right
+            << std::setw(6) << differing << " of " << shown.size()
+            << " pixels differ" << (ok ? "" : "  FAILED") << std::endl;
+}
+
+/// Rows reported complete with their generation, to present as they come
+static std::mutex completed_mutex;
+static std::vector<std::pair<int, unsigned int>> completed_rows;
+
+/**
+ * Present the rows of the current render as they complete, like the
+ * explorer does, until the render is done. Returns the presented rows in
+ * order, each as it was shown.
+ */
+static std::vector<std::pair<int, std::vector<uint32_t>>> present_rows() {
+  std::vector<std::pair<int, std::vector<uint32_t>>> presented;
+  std::atomic_bool done = false;
+  std::thread waiter([&] {
+    render_wait();
+    done = true;
+  });
+  bool last = false;
+  while (!last) {
+    last = done;
+    std::vector<std::pair<int, unsigned int>> rows;
+    {
+      std::lock_guard<std::mutex> lock(completed_mutex);
+      rows.swap(completed_rows);
+    }
+    for (const auto &row : rows) {
+      if (row.first >= height || row.second != render_generation()) continue;
+      render_present_row(row.first);
+      std::vector<uint32_t> shown(width);
+      render_copy_front(shown.data(), row.first * width * 4, width * 4);
+      presented.emplace_back(row.first, shown);
+    }
+    std::this_thread::yield();
+  }
+  waiter.join();
+  return presented;
+}
+
+/**
+ * With a coarse preview, the rows rendered in full over the preview must
+ * give the same result as without. Each row presented while rendering must
+ * be either its preview or the row in full, never a mix, and the presented
+ * frame must end up the same as the rendered one. Restarts the engine with
+ * the preview.
+ */
+static void test_coarse_preview() {
+  const auto &golden = golden_types[std::size(golden_types) - 1];
+  const int block = 4;
+  render_stop();
+  render_options options;
+  options.coarse_block = block;
+  // Enough workers for the rows to wait for their preview
+  options.threads = 4;
+  options.row_complete = [](int row, unsigned int generation) {
+    std::lock_guard<std::mutex> lock(completed_mutex);
+    completed_rows.emplace_back(row, generation);
+  };
+  render_init(options);
+  for (const auto &v : viewports) {
+    set_view(v);
+    user_chosen_float_type = golden.first;
+    start_render();
+    const auto presented = present_rows();
+    field result(width * height);
+    render_copy_iterations(result.data(), 0, result.size());
+    compare(std::string(v.name) + "/coarse preview vs golden", result,
+            read_golden(golden_path(v, golden.second)), golden_tolerance);
+
+    std::vector<uint32_t> rendered(width * height);
+    render_copy_pixels(rendered.data(), 0, rendered.size() * 4);
+    std::vector<uint32_t> shown(width * height);
+    render_copy_front(shown.data(), 0, shown.size() * 4);
+    // Without anti-aliasing, the preview of a pixel is the rendered color of
+    // the top left pixel of its block
+    int mixed = 0;
+    for (const auto &row : presented) {
+      const uint32_t *full = rendered.data() + row.first * width;
+      const uint32_t *top =
+          rendered.data() + row.first / block * block * width;
+      bool is_full = true;
+      bool is_preview = true;
+      for (int col = 0; col < width; ++col) {
+        is_full = is_full && row.second[col] == full[col];
+        is_preview = is_preview && row.second[col] == top[col / block * block];
+      }
+      if (!is_full && !is_preview) ++mixed;
+    }
+    int differing = 0;
+    for (size_t i = 0; i < shown.size(); ++i)
+      if (shown[i] != rendered[i]) ++differing;
+    const bool ok = mixed == 0 && differing == 0;
+    if (!ok) ++failures;
+    std::cout << std::left << std::setw(48)
+              << std::string(v.name) + "/coarse preview presented"
+              << std::right << std::setw(6) << mixed << " of "
+              << presented.size() << " rows mixed, " << differing
+              << " pixels differ"
+              << (ok ? "" : "  FAILED") << std::endl;
+  }
+}
+
+/**
+ * Rows rendered closest to a focus row first, around the real axis where
+ * rows are mirrored, must give the same result as the default order.
+ */
+static void test_focus() {
+  const auto &golden = golden_types[std::size(golden_types) - 1];
+  render_set_focus(height / 3);
+  for (const auto &v : viewports) {
+    set_view(v);
+    compare(std::string(v.name) + "/focused vs golden", render(golden.first),
+            read_golden(golden_path(v, golden.second)), golden_tolerance);
+  }
+  render_set_focus(-1);
+}
+
+static void parse_options(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--update") {
+      update = true;
+    } else if (arg == "--golden" && i + 1 < argc) {
+      golden_dir = argv[++i];
+    } else {
+      throw std::runtime_error("usage: " + std::string(argv[0]) +
+                               " [--update] [--golden DIR]");
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  try {
+    parse_options(argc, argv);
+  } catch (const std::exception &exc) {
+    std::cerr << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  render_reconfigure(width, height);
+  render_init();
+  try {
+    for (const auto &v : viewports) test_viewport(v);
+    if (!update) {
+      test_render_jobs();
+      test_deepening();
+      test_reprojection();
+      test_coarse_preview();
+      test_focus();
+    }
+  } catch (const std::exception &exc) {
+    std::cerr << exc.what() << std::endl;
+    ++failures;
+  }
+  render_stop();
+  std::cout << failures << " failures" << std::endl;
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
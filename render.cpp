@@ -1,284 +1,805 @@
 #include "render.hpp"
 
-#include <SDL2/SDL.h>
-
+#include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 
-#include "application.hpp"
+#include "affinity.hpp"
+#include "calibration.hpp"
+#include "floatdispatch.hpp"
 #include "floattype.hpp"
+#include "jobqueue.hpp"
 #include "mandelbrot.hpp"
 #include "palette.hpp"
-#include "semaphore.hpp"
+#include "renderrow.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 
 flt center_x{-0.60};
 flt center_y{0};
 flt screen_size{2.0};
 uint8_t *pixels = nullptr;
+/// Smooth iteration count of each pixel, LIMIT for pixels inside the set
+static float *iteration_field = nullptr;
+/**
+ * Lock of each row of pixels and iteration_field. Workers render rows into
+ * a row_buffer of their own and copy complete rows in with commit_row().
+ */
+static std::unique_ptr<std::mutex[]> row_mutex;
+/**
+ * The displayed frame. The workers render into pixels, the back buffer, and
+ * completed rows are copied here on the thread that displays them, so the
+ * display never shows a row in progress. Rows not rendered yet keep the
+ * previous frame, reprojected to the current view.
+ */
+static uint8_t *front_pixels = nullptr;
+/// View of the front buffer. Not valid until the first render.
+static bool front_valid = false;
+static flt front_min_x;
+static flt front_min_y;
+static flt front_pixel_size;
 int w;
-flt min_x;
-flt min_y;
 flt pixel_size;
 int pitch;
-semaphore jobs_left;
-std::atomic_int next_job = 0;
-semaphore jobs_done;
-int virtual_rows = 0;
+job_queue jobs;
 int rows = 0;
-int row_bits;
 bool rendering = false;
 std::atomic_bool running = true;
 int jobs_remaining = 0;
 FloatType user_chosen_float_type = FT_AUTO; /** Type chosen by user */
 FloatType render_float_type = FT_AUTO;      /**< Type used for render */
+Antialias antialias = AA_NONE;
+bool predict_interior = true;
 std::vector<std::thread> threads;
+static render_options options;    /**< Thread pool options */
+static std::vector<int> worker_cpu; /**< CPU of each worker, if pinned */
+
+using render_clock = std::chrono::steady_clock;
+
+/// Counters of each worker
+static std::unique_ptr<worker_counters[]> counters;
+/// Counters of each worker at the start of the current frame
+static std::vector<counter_values> counters_base;
+/// Start time of the current frame
+static render_clock::time_point frame_start;
+/// Row the user looks at, rendered first, or -1
+static std::atomic_int focus_row{-1};
+/// Time of the last cancel
+static std::atomic<render_clock::rep> cancel_time{0};
+/// Time from the last cancel until the last worker left the cancelled frame
+static std::atomic<render_clock::rep> cancel_latency{0};
+
+/// Nanoseconds in a duration
+static uint64_t ns(render_clock::duration d) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+static const palette pal;
+
+/**
+ * Parameters of a render: its view and the order of its rows. A frame is
+ * created by start_render() and not modified afterwards, so workers still
+ * finishing rows of a cancelled render keep a consistent view while the next
+ * render starts.
+ */
+struct frame : render_view {
+  unsigned int generation; /**< Job queue generation of the render */
+  int row_bits;
+  int virtual_rows;
+  /**
+   * Rows in the order they are rendered, padded to virtual_rows with rows
+   * past the end
+   */
+  std::vector<int> row_order;
+  /**
+   * With coarse_block > 1, a preview pass of virtual_rows jobs runs before
+   * the rows: each block of coarse_block by coarse_block pixels gets the
+   * color of its top left pixel. coarse_order is the order of its rows, the
+   * top rows of the blocks first, and coarse_done is set for each row done.
+   */
+  int coarse_block;
+  std::vector<int> coarse_order;
+  std::unique_ptr<std::atomic_bool[]> coarse_done;
+  /**
+   * Set for each of the virtual_rows rows when a job of the first pass has
+   * claimed it. Jobs claim rows as they start, so the order follows the
+   * focus row as it moves.
+   */
+  std::unique_ptr<std::atomic_bool[]> row_claimed;
+  render_clock::time_point start_time;
+  Antialias antialias;
+  /**
+   * Set when the first sample of each pixel of a row is done. Adaptive
+   * anti-aliasing of a row waits for its neighbors.
+   */
+  std::unique_ptr<std::atomic_bool[]> row_done;
+  /**
+   * For rows mirrored around the real axis by another row: the row is not
+   * rendered, but copied by the other row. mirror_to is the row a rendered
+   * row is copied to, or -1, and mirror_from the row a mirrored row is
+   * copied from.
+   */
+  std::vector<bool> mirrored;
+  std::vector<int> mirror_to;
+  std::vector<int> mirror_from;
+};
 
-static palette pal;
+/// Frame being rendered
+static std::shared_ptr<const frame> current_frame;
 
 /// Map sequentially numbered row to order to reverse bit order. Lets us render
 /// all parts of the screen at the same time instead of top to bottom.
-static int maprow(int row) {
-  row = row % virtual_rows;
+static int maprow(const frame &f, int row) {
+  row = row % f.virtual_rows;
   int res = 0;
-  for (int i = 0; i < row_bits; ++i) {
+  for (int i = 0; i < f.row_bits; ++i) {
     res = (res << 1) | (row & 1);
     row >>= 1;
   }
   return res;
 }
 
-void notify_row_complete(int row) {
-  SDL_Event event;
-  memset(&event, 0, sizeof(event));
-  event.type = ROWRENDER_COMPLETE_EVENT;
-  event.user.code = row;
-  SDL_PushEvent(&event);
-}
-
-/// Blend two colors by fraction of each.
-uint32_t blend(uint32_t c1, uint32_t c2, float f) {
-  uint8_t r1 = c1 >> 24;
-  uint8_t g1 = (c1 >> 16) & 0xff;
-  uint8_t b1 = (c1 >> 8) & 0xff;
-  uint8_t a1 = (c1)&0xff;
-  uint8_t r2 = c2 >> 24;
-  uint8_t g2 = (c2 >> 16) & 0xff;
-  uint8_t b2 = (c2 >> 8) & 0xff;
-  uint8_t a2 = (c2)&0xff;
-  int s1 = 255 * f;
-  int s2 = 255 - s1;
-  uint8_t r3 = (r1 * s1 + r2 * s2) / 256;
-  uint8_t g3 = (g1 * s1 + g2 * s2) / 256;
-  uint8_t b3 = (b1 * s1 + b2 * s2) / 256;
-  uint8_t a3 = (a1 * s1 + a2 * s2) / 256;
-  return (r3 << 24) | (g3 << 16) | (b3 << 8) | (a3);
+/// Rows from the center of the screen out, among those selected
+template <typename SELECT>
+static void add_center_out(const frame &f, std::vector<int> &order,
+                           SELECT select) {
+  const int center = f.height / 2;
+  for (int distance = 0; distance <= center; ++distance) {
+    const int above = center - distance;
+    const int below = center + distance;
+    if (select(above)) order.push_back(above);
+    if (distance > 0 && below < f.height && select(below))
+      order.push_back(below);
+  }
 }
 
 /**
- * Render a single row of the mandelbrot set
+ * Order the rows of a frame. With a coarse preview the whole screen is
+ * covered early, so the rows are rendered from the center out, where detail
+ * is looked for first. Without, rows are rendered in bit reversed order.
  */
-template <typename FLT>
-void render_rowx(int row) {
-  const FLT scl = FLT(pixel_size);
-  const FLT minx = FLT(min_x);
-  const FLT miny = FLT(min_y);
-  row = maprow(row);
-  if (row < rows) {
-    FLT yc = miny + FLT(row) * scl;
-    uint32_t *row_pixels = reinterpret_cast<uint32_t *>(pixels + row * pitch);
-    for (int col = 0; col < w; ++col) {
-      auto result = iter(minx + FLT(col) * scl, yc);
-      if (result.iterations == LIMIT) {
-        *row_pixels++ = 0x00;
-      } else {
-        FLT zx2 = result.x;
-        FLT zy2 = result.y;
-        double sum = result.iterations + fraction(zx2, zy2);
-        unsigned int n = (unsigned int)floor(double(sum));
-        double f2 = sum - double(n);
-        unsigned int n1 = n % 256;
-        double f1 = 1.0 - f2;
-        unsigned int n2 = ((n1 + 1) % 256);
-        *row_pixels++ = blend(pal[n1], pal[n2], f1);
+static void order_rows(frame &f) {
+  f.row_order.clear();
+  f.coarse_order.clear();
+  if (f.coarse_block > 1) {
+    add_center_out(f, f.row_order, [](int) { return true; });
+    add_center_out(f, f.coarse_order,
+                   [&](int row) { return row % f.coarse_block == 0; });
+    add_center_out(f, f.coarse_order,
+                   [&](int row) { return row % f.coarse_block != 0; });
+    for (int row = f.height; row < f.virtual_rows; ++row) {
+      f.row_order.push_back(row);
+      f.coarse_order.push_back(row);
+    }
+  } else {
+    for (int job = 0; job < f.virtual_rows; ++job)
+      f.row_order.push_back(maprow(f, job));
+  }
+}
+
+/// Claim a row for the first pass. Returns false if already claimed.
+static bool try_claim(const frame &f, int row) {
+  return !f.row_claimed[row].load(std::memory_order_relaxed) &&
+         !f.row_claimed[row].exchange(true);
+}
+
+/**
+ * Claim the next row for a job of the first pass: the unclaimed row closest
+ * to the focus row if there is one, otherwise the first unclaimed row of
+ * row_order from the place of the job. A mirrored row close to the focus
+ * claims the row it is copied from instead. There are as many jobs as rows,
+ * so every job gets one.
+ */
+static int claim_row(const frame &f, int job) {
+  const int focus = focus_row.load(std::memory_order_relaxed);
+  if (focus >= 0 && focus < f.height) {
+    for (int distance = 0; distance < f.height; ++distance) {
+      for (int row : {focus - distance, focus + distance}) {
+        if (row < 0 || row >= f.height) continue;
+        const int source = f.mirrored[row] ? f.mirror_from[row] : row;
+        if (try_claim(f, source)) return source;
       }
     }
   }
+  for (int i = 0; i < f.virtual_rows; ++i) {
+    const int row = f.row_order[(job + i) % f.virtual_rows];
+    if (try_claim(f, row)) return row;
+  }
+  return f.height;  // Not reached
+}
+
+/// A row rendered by a worker, copied to the shared buffers when complete
+struct row_buffer {
+  explicit row_buffer(int width) : pixels(width), iterations(width) {}
+  std::vector<uint32_t> pixels;
+  std::vector<float> iterations;
+};
+
+/**
+ * Copy a row rendered by a worker to the shared buffers, also the iteration
+ * field if iterations is set. The generation is checked under the lock of
+ * the row, and the next render writes the row under the same lock after the
+ * generation has changed, so a cancelled worker never overwrites a row of
+ * the next render. Returns false if the render was cancelled.
+ */
+static bool commit_row(const frame &f, int row, const row_buffer &buffer,
+                       bool iterations) {
+  std::lock_guard<std::mutex> lock(row_mutex[row]);
+  if (jobs.generation() != f.generation) return false;
+  memcpy(pixels + row * pitch, buffer.pixels.data(), pitch);
+  if (iterations) {
+    memcpy(iteration_field + row * f.width, buffer.iterations.data(),
+           f.width * sizeof(float));
+  }
+  return true;
+}
+
+/// Copy a row of the shared buffers, for a worker to continue from.
+static void load_row(const frame &f, int row, row_buffer &buffer) {
+  std::lock_guard<std::mutex> lock(row_mutex[row]);
+  memcpy(buffer.pixels.data(), pixels + row * pitch, pitch);
+  memcpy(buffer.iterations.data(), iteration_field + row * f.width,
+         f.width * sizeof(float));
+}
+
+/// Report a completed row to the callback given in the render options.
+static void notify_row_complete(int row, unsigned int generation) {
+  if (options.row_complete) options.row_complete(row, generation);
+}
+
+/// Color of a value of the iteration field
+static uint32_t field_color(float value) {
+  return value == LIMIT ? 0x00 : pal.color(value);
+}
+
+/// Largest difference of any channel of two colors
+static int color_difference(uint32_t c1, uint32_t c2) {
+  int difference = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    const int d = int((c1 >> shift) & 0xff) - int((c2 >> shift) & 0xff);
+    difference = std::max(difference, std::abs(d));
+  }
+  return difference;
+}
+
+/// Pixels whose color differs more than this from a neighbor are refined
+static const int refine_threshold = 24;
+/// Samples per axis added to a refined pixel
+static const int refine_samples = 3;
 
-  notify_row_complete(row);
+/// Pseudo random number in [0, 1) from a seed, for sample jitter
+static double jitter(uint32_t seed) {
+  seed ^= seed >> 16;
+  seed *= 0x7feb352d;
+  seed ^= seed >> 15;
+  seed *= 0x846ca68b;
+  seed ^= seed >> 16;
+  return seed / 4294967296.0;
 }
 
-/// Shorthand for epsilon
+/**
+ * Second pass of adaptive anti-aliasing of a row. Pixels whose first sample
+ * differs in color from a neighbor get a stratified, jittered grid of extra
+ * samples. Neighbors are compared through the iteration field, which this
+ * pass leaves alone, so rows can be refined in any order. The refined colors
+ * of the row are left in out.pixels.
+ */
 template <typename FLT>
-flt epsilon() {
-  // return std::numeric_limits<FLT>::epsilon();
-  return flt(std::numeric_limits<FLT>::epsilon());
-};
+bool refine_rowx(const frame &f, int row, row_buffer &out,
+                 worker_counters &c) {
+  // The rows above and below must have their first samples
+  for (int r = std::max(0, row - 1); r <= std::min(f.height - 1, row + 1);
+       ++r) {
+    while (!f.row_done[r]) {
+      if (jobs.generation() != f.generation) return false;
+      std::this_thread::yield();
+    }
+  }
+
+  const std::vector<FLT> &xc = render_view_columns<FLT>(f);
+  const FLT yc = FLT(f.min_y + row * f.pixel_size);
+  const FLT size = FLT(f.pixel_size);
+  row_buffer above(f.width);
+  row_buffer below(f.width);
+  load_row(f, row, out);
+  if (row > 0) load_row(f, row - 1, above);
+  if (row + 1 < f.height) load_row(f, row + 1, below);
+  uint32_t *row_pixels = out.pixels.data();
+  const float *field = out.iterations.data();
+  // Samples are accumulated as floats and only resolved to a color at the end
+  std::vector<color_sum> sums(f.width);
+  std::vector<int> counts(f.width, 0);
+  uint64_t iterations = 0;
+  int refined = 0;
+  int col = 0;
+  for (; col < f.width; ++col) {
+    const uint32_t color = field_color(field[col]);
+    int difference = 0;
+    if (col > 0)
+      difference = color_difference(color, field_color(field[col - 1]));
+    if (col + 1 < f.width)
+      difference = std::max(
+          difference, color_difference(color, field_color(field[col + 1])));
+    if (row > 0)
+      difference = std::max(difference, color_difference(color, field_color(
+                                            above.iterations[col])));
+    if (row + 1 < f.height)
+      difference = std::max(difference, color_difference(color, field_color(
+                                            below.iterations[col])));
+    if (difference <= refine_threshold) continue;
 
-/// Chose the floating point type that is the fastest at the require precision.
-FloatType determine_type() {
-  if (pixel_size > epsilon<float>())
-    return FT_FLOAT;
-  else if (pixel_size > epsilon<double>())
-    return FT_DOUBLE;
-  else if (pixel_size > epsilon<long double>())
-    return FT_LONG_DOUBLE;
-  else if (pixel_size > epsilon<__float80>())
-    return FT_FLOAT80;
-  else if (pixel_size > epsilon<doubledouble<float>>())
-    return FT_DOUBLEFLOAT;
-  else if (pixel_size > epsilon<doubledouble<double>>())
-    return FT_DOUBLEDOUBLE;
-  else if (pixel_size > epsilon<doubledouble<__float80>>())
-    return FT_DOUBLEFLOAT80;
-  else if (pixel_size > epsilon<__float128>())
-    return FT_FLOAT128;
-  else if (pixel_size > epsilon<doubledouble<long double>>())
-    return FT_LONG_DOUBLE;
-  else if (pixel_size > epsilon<doubledouble<__float128>>())
-    return FT_DOUBLEFLOAT128;
-  else if (pixel_size > epsilon<gmpfloat<128>>())
-    return FT_GMPFLOAT128;
-  else
-    return FT_GMPFLOAT256;
+    if (jobs.generation() != f.generation) break;
+    ++refined;
+    sums[col].add(row_pixels[col]);
+    counts[col] = 1;
+    for (int sy = 0; sy < refine_samples; ++sy) {
+      for (int sx = 0; sx < refine_samples; ++sx) {
+        const uint32_t seed =
+            ((row * f.width + col) * refine_samples + sy) * refine_samples +
+            sx;
+        const double jx = (sx + jitter(2 * seed)) / refine_samples - 0.5;
+        const double jy = (sy + jitter(2 * seed + 1)) / refine_samples - 0.5;
+        auto sample = iter(xc[col] + FLT(jx) * size, yc + FLT(jy) * size);
+        iterations += sample.iterations;
+        sums[col].add(
+            sample.iterations == LIMIT
+                ? 0x00
+                : pal.color(sample.iterations +
+                                fraction(sample.x, sample.y)));
+        ++counts[col];
+      }
+    }
+  }
+  if (col < f.width) return false;
+  for (col = 0; col < f.width; ++col)
+    if (counts[col] > 0) row_pixels[col] = sums[col].average(counts[col]);
+  worker_counters::add(c.supersampled, refined);
+  worker_counters::add(c.iterations, iterations);
+  return true;
+}
+
+/// Sample the first pixel of each coarse block of a row for the preview
+template <typename FLT>
+bool coarse_rowx(const frame &f, int row, row_buffer &out,
+                 worker_counters &c) {
+  const std::vector<FLT> &xc = render_view_columns<FLT>(f);
+  const FLT yc = FLT(f.min_y + row * f.pixel_size);
+  uint32_t *row_pixels = out.pixels.data();
+  float *row_iterations = out.iterations.data();
+  uint64_t iterations = 0;
+  for (int col = 0; col < f.width; col += f.coarse_block) {
+    auto result = iter(xc[col], yc);
+    if (jobs.generation() != f.generation) return false;
+    iterations += result.iterations;
+    const float value =
+        result.iterations == LIMIT
+            ? LIMIT
+            : float(result.iterations + fraction(result.x, result.y));
+    const int end = std::min(col + f.coarse_block, f.width);
+    std::fill(row_pixels + col, row_pixels + end, field_color(value));
+    std::fill(row_iterations + col, row_iterations + end, value);
+  }
+  worker_counters::add(c.iterations, iterations);
+  return true;
 }
 
 /**
- * Render specified row using selected floating point type.
+ * Wait until the coarse preview of a row is done, so that it does not
+ * overwrite the row rendered in full. Returns false if the render was
+ * cancelled.
  */
-void render_row(int row) {
-  switch (render_float_type) {
-    case FT_FLOAT:
-      render_rowx<float>(row);
-      break;
-    case FT_DOUBLE:
-      render_rowx<double>(row);
-      break;
-    case FT_DOUBLEDOUBLE:
-      render_rowx<doubledouble<double>>(row);
-      break;
-#if HAVE_FLOAT80
-    case FT_FLOAT80:
-      render_rowx<__float80>(row);
-      break;
-    case FT_DOUBLEFLOAT80:
-      render_rowx<doubledouble<__float80>>(row);
-      break;
-#endif
-#if HAVE_FLOAT128
-    case FT_FLOAT128:
-      render_rowx<__float128>(row);
-      break;
-    case FT_DOUBLEFLOAT128:
-      render_rowx<doubledouble<__float128>>(row);
-      break;
-#endif
-#if HAVE_LONG_DOUBLE
-    case FT_LONG_DOUBLE:
-      render_rowx<long double>(row);
-      break;
-#endif
-#if HAVE_LIBGMP
-    case FT_GMPFLOAT128:
-      render_rowx<gmpfloat<128>>(row);
-      break;
-    case FT_GMPFLOAT256:
-      render_rowx<gmpfloat<256>>(row);
-      break;
-#endif
-#if HAVE_LIBMPFR
-    case FT_MPFRFLOAT128:
-      render_rowx<mpfrfloat<128>>(row);
-      break;
-    case FT_MPFRFLOAT256:
-      render_rowx<mpfrfloat<256>>(row);
-      break;
-#endif
-    default:
-      abort();
+static bool wait_coarse(const frame &f, int row) {
+  if (f.coarse_block <= 1) return true;
+  while (!f.coarse_done[row]) {
+    if (jobs.generation() != f.generation) return false;
+    std::this_thread::yield();
   }
+  return true;
+}
+
+/**
+ * Coarse preview of a row. The top rows of the blocks are sampled, the
+ * other rows copy the top row of their block once it is done.
+ */
+static bool render_coarse_row(const frame &f, int row, worker_counters &c) {
+  const int top = row - row % f.coarse_block;
+  row_buffer buffer(f.width);
+  bool complete;
+  if (row == top) {
+    with_float_type(f.float_type, [&](auto tag) {
+      using FLT = typename decltype(tag)::type;
+      complete = coarse_rowx<FLT>(f, row, buffer, c);
+    });
+  } else {
+    complete = wait_coarse(f, top);
+    if (complete) load_row(f, top, buffer);
+  }
+  complete = complete && commit_row(f, row, buffer, true);
+  if (complete) f.coarse_done[row] = true;
+  return complete;
+}
+
+/// Add the work done on a row to the counters of a worker.
+static void add_counts(worker_counters &c, const row_counts &counts) {
+  worker_counters::add(c.pixels, counts.pixels);
+  worker_counters::add(c.escaped, counts.escaped);
+  worker_counters::add(c.predicted, counts.predicted);
+  worker_counters::add(c.supersampled, counts.supersampled);
+  worker_counters::add(c.iterations, counts.iterations);
+}
+
+/**
+ * Render specified row using the floating point type of the frame. With
+ * a coarse preview, the first virtual_rows jobs are the preview. Jobs after
+ * the virtual_rows of the rows are the second, refining pass of adaptive
+ * anti-aliasing.
+ */
+void render_row(const frame &f, int job, worker_counters &c) {
+  const int coarse_jobs = f.coarse_block > 1 ? f.virtual_rows : 0;
+  if (job < coarse_jobs) {
+    const int row = f.coarse_order[job];
+    const auto start = render_clock::now();
+    const bool complete = row >= f.height || render_coarse_row(f, row, c);
+    if (row < f.height)
+      trace_complete(complete ? "coarse" : "coarse cancelled", start, row);
+    if (complete) notify_row_complete(row, f.generation);
+    return;
+  }
+  job -= coarse_jobs;
+  const bool refine = job >= f.virtual_rows;
+  const int row =
+      refine ? f.row_order[job - f.virtual_rows] : claim_row(f, job);
+  // The row that mirrors this one notifies for both
+  if (row < f.height && f.mirrored[row]) return;
+  bool complete = true;
+  if (row < f.height) {
+    const auto start = render_clock::now();
+    const FloatType type = f.float_type;
+    const int mirror = f.mirror_to[row];
+    if (!refine) {
+      worker_counters::add(c.queue_wait_ns, ns(start - f.start_time));
+      complete = wait_coarse(f, row) && (mirror < 0 || wait_coarse(f, mirror));
+    }
+    row_buffer buffer(f.width);
+    if (complete && refine) {
+      with_float_type(type, [&](auto tag) {
+        using FLT = typename decltype(tag)::type;
+        complete = refine_rowx<FLT>(f, row, buffer, c);
+      });
+    } else if (complete) {
+      const row_output out{buffer.pixels.data(), buffer.iterations.data()};
+      const auto cancelled = [&] { return jobs.generation() != f.generation; };
+      row_counts counts;
+      complete = f.antialias == AA_DISTANCE
+                     ? render_view_row_de(f, row, out, counts, cancelled)
+                     : render_view_row(f, row, out, counts, cancelled);
+      add_counts(c, counts);
+    }
+    worker_counters::add(c.type_ns[type], ns(render_clock::now() - start));
+    // The refining pass leaves the iteration field alone
+    complete = complete && commit_row(f, row, buffer, !refine);
+    if (complete && mirror >= 0) {
+      // The set is symmetric around the real axis
+      complete = commit_row(f, mirror, buffer, !refine);
+      if (complete && !refine) worker_counters::add(c.mirrored, 1);
+    }
+    if (complete && !refine) {
+      worker_counters::add(c.rows, 1);
+      if (mirror >= 0) f.row_done[mirror] = true;
+      f.row_done[row] = true;
+    }
+    trace_complete(complete ? (refine ? "refine" : "row") : "row cancelled",
+                   start, row, floattypenames[type]);
+    if (complete && mirror >= 0) notify_row_complete(mirror, f.generation);
+  }
+
+  if (complete) notify_row_complete(row, f.generation);
 }
 
 /**
  * Cancel current rendering progress. Auto to abort render when rending
- * parameters change.
+ * parameters change. Does not wait for the workers; rows in progress are
+ * abandoned at the next pixel and the next render can start right away.
  */
 void cancel_render() {
   if (!rendering) return;
-  // Steal remaining jobs
-  while (jobs_left.try_acquire()) jobs_done.release(1);
+  cancel_latency = 0;
+  cancel_time = render_clock::now().time_since_epoch().count();
+  trace_instant("cancel", jobs.generation());
+  jobs.cancel();
+  rendering = false;
+}
 
-  // Wait for all workers to complete
-  for (int i = 0; i < virtual_rows; ++i) jobs_done.acquire();
+/// Record that a worker has left a cancelled frame.
+static void note_cancel_drained(render_clock::time_point now) {
+  auto latency = now.time_since_epoch().count() - cancel_time;
+  auto current = cancel_latency.load();
+  while (latency > current &&
+         !cancel_latency.compare_exchange_weak(current, latency)) {
+  }
+}
 
-  rendering = false;
+/**
+ * Move the view vertically by up to a quarter pixel so that center_y is a
+ * multiple of half a pixel, if the view straddles the real axis. Rows are
+ * then placed symmetrically around the axis.
+ */
+static void align_symmetry() {
+  const double half_pixels = get_double(center_y / (pixel_size / flt(2.0)));
+  if (std::abs(half_pixels) >= rows) return;
+  center_y = flt(std::round(half_pixels)) * pixel_size / flt(2.0);
+}
+
+/**
+ * Find the pairs of rows that mirror each other around the real axis. Row r
+ * is at y = min_y + r * pixel_size, so it mirrors row k - r where
+ * k = -2 * min_y / pixel_size, provided k is an integer.
+ */
+static void find_mirrored_rows(frame &f) {
+  f.mirrored.assign(f.height, false);
+  f.mirror_to.assign(f.height, -1);
+  f.mirror_from.assign(f.height, -1);
+  const double k = get_double(flt(-2.0) * f.min_y / f.pixel_size);
+  const long kr = std::lround(k);
+  if (k < 0.0 || k > 2.0 * f.height || std::abs(k - kr) > 1e-6) return;
+  for (int row = 0; row < f.height; ++row) {
+    const int mirror = kr - row;
+    if (mirror > row && mirror < f.height) {
+      f.mirror_to[row] = mirror;
+      f.mirrored[mirror] = true;
+      f.mirror_from[mirror] = row;
+    }
+  }
+}
+
+/**
+ * Resample the front buffer from its view to the view of a new frame, with
+ * the nearest pixel. Pixels outside the previous view keep their old color
+ * until rendered.
+ */
+static void reproject_front(const frame &f) {
+  trace_span span("reproject");
+  const bool valid = front_valid;
+  const flt old_min_x = front_min_x;
+  const flt old_min_y = front_min_y;
+  const flt old_pixel_size = front_pixel_size;
+  front_valid = true;
+  front_min_x = f.min_x;
+  front_min_y = f.min_y;
+  front_pixel_size = f.pixel_size;
+  if (!valid) return;
+
+  // Position and size of the new pixels in pixels of the old view
+  const double x0 = get_double((f.min_x - old_min_x) / old_pixel_size);
+  const double y0 = get_double((f.min_y - old_min_y) / old_pixel_size);
+  const double scale = get_double(f.pixel_size / old_pixel_size);
+  if (x0 == 0.0 && y0 == 0.0 && scale == 1.0) return;
+  std::vector<uint32_t> previous(
+      reinterpret_cast<const uint32_t *>(front_pixels),
+      reinterpret_cast<const uint32_t *>(front_pixels) + f.width * f.height);
+  for (int row = 0; row < f.height; ++row) {
+    uint32_t *out = reinterpret_cast<uint32_t *>(front_pixels + row * pitch);
+    const double sy = std::floor(y0 + (row + 0.5) * scale);
+    for (int col = 0; col < f.width; ++col) {
+      const double sx = std::floor(x0 + (col + 0.5) * scale);
+      if (sx >= 0 && sx < f.width && sy >= 0 && sy < f.height)
+        out[col] = previous[int(sy) * f.width + int(sx)];
+    }
+  }
 }
 
 /**
  * Start render
  */
 void start_render() {
+  trace_span span("start_render");
+  auto f = std::make_shared<frame>();
+  f->generation = jobs.next_generation();
+  f->width = w;
+  f->height = rows;
+  f->antialias = antialias;
+  f->predict_interior = predict_interior;
   pixel_size = screen_size / flt(rows);
-  render_float_type = user_chosen_float_type == FT_AUTO
-                          ? determine_type()
-                          : user_chosen_float_type;
-  min_x = center_x - w * pixel_size / flt(2.0);
-  min_y = center_y - rows * pixel_size / flt(2.0);
-
-  // std::cout.precision(std::numeric_limits<decltype(min_x)>::digits10);
-  // std::cout << "type: " << tname<decltype(min_x)>() << std::endl;
-  // std::cout << "digits: " << std::numeric_limits<decltype(min_x)>::digits10
-  //           << std::endl;
-  // std::cout << "min_x: " << min_x << std::endl;
-  // std::cout << "min_y: " << min_y << std::endl;
-
-  row_bits = log2(rows) + 1;
-  virtual_rows = 1 << row_bits;
-  jobs_left.release(virtual_rows);
-  jobs_remaining = virtual_rows;
+  f->pixel_size = pixel_size;
+  if (options.align_symmetry) align_symmetry();
+  f->min_x = center_x - w * pixel_size / flt(2.0);
+  f->min_y = center_y - rows * pixel_size / flt(2.0);
+  find_mirrored_rows(*f);
+  reproject_front(*f);
+
+  f->limit = LIMIT;
+  render_view_prepare(*f, user_chosen_float_type);
+  render_float_type = f->float_type;
+
+  f->row_bits = log2(rows) + 1;
+  f->virtual_rows = 1 << f->row_bits;
+  f->coarse_block = options.coarse_block;
+  order_rows(*f);
+  // Adaptive anti-aliasing refines each row in a second pass of jobs, and a
+  // coarse preview adds a pass before the rows
+  const int passes =
+      (f->antialias == AA_ADAPTIVE ? 2 : 1) + (f->coarse_block > 1 ? 1 : 0);
+  f->row_done.reset(new std::atomic_bool[rows]());
+  f->row_claimed.reset(new std::atomic_bool[f->virtual_rows]());
+  if (f->coarse_block > 1) f->coarse_done.reset(new std::atomic_bool[rows]());
+  jobs_remaining = passes * f->virtual_rows;
   rendering = true;
+  for (size_t i = 0; i < threads.size(); ++i)
+    counters_base[i] = counters[i].read();
+  frame_start = f->start_time = render_clock::now();
+  std::atomic_store(&current_frame, std::shared_ptr<const frame>(f));
+  jobs.start(passes * f->virtual_rows);
 }
 
+unsigned int render_generation() { return jobs.generation(); }
+
+void render_set_focus(int row) { focus_row = row; }
+
 /**
  * Rendering worker main function.
  */
-void worker() {
-  while (true) {
-    jobs_left.acquire();
-    if (!running) {
-      break;
-    }
-    auto job = next_job++;
-    render_row(job);
-    jobs_done.release(1);
+void worker(int index) {
+  trace_thread_name("worker");
+  if (!worker_cpu.empty() && !pin_current_thread(worker_cpu[index]))
+    std::cerr << "failed to pin worker " << index << std::endl;
+  if (options.idle && !set_current_thread_idle())
+    std::cerr << "failed to lower priority of worker " << index << std::endl;
+
+  worker_counters &c = counters[index];
+  job_queue::job job;
+  auto idle_start = render_clock::now();
+  while (jobs.take(job)) {
+    const auto start = render_clock::now();
+    worker_counters::add(c.idle_ns, ns(start - idle_start));
+    auto f = std::atomic_load(&current_frame);
+    // The frame may already have been replaced if the job was cancelled
+    if (f->generation == job.generation) render_row(*f, job.index, c);
+    jobs.finish();
+    idle_start = render_clock::now();
+    worker_counters::add(c.busy_ns, ns(idle_start - start));
+    if (job.generation != jobs.generation()) note_cancel_drained(idle_start);
   }
 }
 
-void render_init() {
-  const int thread_count = std::thread::hardware_concurrency();
+/**
+ * Touch the pixel buffers from the CPUs of the workers, so that on NUMA
+ * systems the pages are spread over the nodes the workers run on instead of
+ * all ending up on the node of the thread that happens to write first. Rows
+ * are touched round-robin since any worker may render any row.
+ */
+static void first_touch() {
+  const int count = worker_cpu.size();
+  std::vector<std::thread> touchers;
+  for (int i = 0; i < count; ++i) {
+    touchers.emplace_back([i, count] {
+      pin_current_thread(worker_cpu[i]);
+      for (int row = i; row < rows; row += count) {
+        memset(pixels + row * pitch, 0, pitch);
+        memset(iteration_field + row * w, 0, w * sizeof(float));
+      }
+    });
+  }
+  for (auto &thr : touchers) thr.join();
+}
+
+void render_init(const render_options &opts) {
+  options = opts;
+  calibration_load(options.calibration_file.empty()
+                       ? calibration_default_path()
+                       : options.calibration_file);
+
+  const std::vector<int> cpus = available_cpus();
+  const int thread_count =
+      options.threads > 0 ? options.threads : int(cpus.size());
+  if (options.pin) {
+    // Spread workers evenly when there are fewer workers than CPUs. CPUs of
+    // a NUMA node are usually numbered consecutively, so this also spreads
+    // them over the nodes.
+    for (int i = 0; i < thread_count; ++i) {
+      int cpu = (i * cpus.size() / thread_count) % cpus.size();
+      worker_cpu.push_back(cpus[cpu]);
+    }
+    first_touch();
+  }
+
+  counters.reset(new worker_counters[thread_count]);
+  counters_base.resize(thread_count);
+
   std::cout << "starting " << thread_count << " workers" << std::endl;
   for (int i = 0; i < thread_count; ++i) {
-    threads.push_back(std::thread(worker));
+    threads.push_back(std::thread(worker, i));
   }
 }
 
 void render_reconfigure(int width, int height) {
+  // Cancelled rows may still be writing to the old buffer
+  jobs.wait_idle();
   delete[] pixels;
   pixels = new uint8_t[width * height * 4];
+  delete[] iteration_field;
+  iteration_field = new float[width * height];
+  row_mutex.reset(new std::mutex[height]);
+  delete[] front_pixels;
+  front_pixels = new uint8_t[width * height * 4]();
+  front_valid = false;
   pitch = width * 4;
   rows = height;
   w = width;
+  if (!worker_cpu.empty()) first_touch();
 }
 
+void render_wait() { jobs.wait_done(); }
+
 void render_stop() {
-  jobs_left.release(threads.size());
+  jobs.stop();
   for (auto &thr : threads) thr.join();
+  threads.clear();
+  worker_cpu.clear();
+  jobs.restart();
 }
 
 void render_copy_pixels(void *dest, size_t offset, size_t length) {
   memcpy(dest, pixels + offset, length);
 }
 
+void render_present_row(int row) {
+  if (row >= rows) return;
+  // Workers commit whole rows under the same lock, so the copy never sees a
+  // row half overwritten by a later pass or render
+  std::lock_guard<std::mutex> lock(row_mutex[row]);
+  memcpy(front_pixels + row * pitch, pixels + row * pitch, pitch);
+}
+
+void render_copy_front(void *dest, size_t offset, size_t length) {
+  memcpy(dest, front_pixels + offset, length);
+}
+
+void render_copy_iterations(float *dest, size_t offset, size_t count) {
+  memcpy(dest, iteration_field + offset, count * sizeof(float));
+}
+
+render_stats render_get_stats() {
+  render_stats stats{};
+  stats.elapsed_ms = ns(render_clock::now() - frame_start) * 1e-6;
+  uint64_t queue_wait_ns = 0;
+  for (size_t i = 0; i < threads.size(); ++i) {
+    const counter_values now = counters[i].read();
+    const counter_values &base = counters_base[i];
+    stats.rows += now.rows - base.rows;
+    stats.pixels += now.pixels - base.pixels;
+    stats.escaped += now.escaped - base.escaped;
+    stats.supersampled += now.supersampled - base.supersampled;
+    stats.mirrored += now.mirrored - base.mirrored;
+    stats.predicted += now.predicted - base.predicted;
+    stats.iterations += now.iterations - base.iterations;
+    queue_wait_ns += now.queue_wait_ns - base.queue_wait_ns;
+    for (int type = 0; type < FT_MAX; ++type)
+      stats.type_ms[type] += (now.type_ns[type] - base.type_ns[type]) * 1e-6;
+    stats.threads.push_back(thread_stats{now.rows - base.rows,
+                                         (now.busy_ns - base.busy_ns) * 1e-6,
+                                         (now.idle_ns - base.idle_ns) * 1e-6});
+  }
+  stats.interior = stats.pixels - stats.escaped;
+  if (stats.rows > 0) stats.queue_wait_ms = queue_wait_ns * 1e-6 / stats.rows;
+  stats.cancel_latency_ms =
+      std::chrono::duration<double, std::milli>(
+          render_clock::duration(cancel_latency.load()))
+          .count();
+  return stats;
+}
+
 const char *render_get_float_type_name() {
   return floattypenames[render_float_type];
 }
+
+const char *render_get_antialias_name() {
+  static const char *names[AA_MAX] = {"no anti-aliasing",
+                                      "distance estimated anti-aliasing",
+                                      "adaptive anti-aliasing"};
+  return names[antialias];
+}
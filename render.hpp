@@ -3,8 +3,11 @@
 
 #include "floattype.hpp"
 #include "float.hpp"
+#include "stats.hpp"
 
 #include <atomic>
+#include <functional>
+#include <string>
 
 extern flt center_x;
 extern flt center_y;
@@ -15,9 +18,7 @@ extern uint8_t *pixels;
 // extern flt min_y;
 extern flt pixel_size;
 extern int pitch;
-// extern semaphore jobs_left;
-// extern std::atomic_int next_job = 0;
-// extern semaphore jobs_done;
+// extern job_queue jobs;
 // extern int virtual_rows = 0;
 extern int rows;
 // extern int row_bits;
@@ -28,24 +29,112 @@ extern int jobs_remaining;
 extern FloatType user_chosen_float_type; /** Type chosen by user */
 // extern FloatType render_float_type = FT_AUTO;      /**< Type used for render */
 
+/// Anti-aliasing modes
+enum Antialias {
+  AA_NONE,      ///< One sample per pixel
+  AA_DISTANCE,  ///< Supersample pixels near the boundary by distance estimate
+  AA_ADAPTIVE,  ///< Add jittered samples where neighboring pixels differ
+  AA_MAX
+};
+extern Antialias antialias;
+
+/**
+ * Recognize interior pixels by the attracting cycle found for the previous
+ * pixel of the row, instead of iterating them up to the limit
+ */
+extern bool predict_interior;
+
+/// Options for the rendering engine
+struct render_options {
+  int threads = 0;   ///< Number of workers. 0 for one per available CPU.
+  bool pin = false;  ///< Pin each worker to its own CPU
+  bool idle = false; ///< Run workers at idle priority (background renders)
+  std::string stats_file; ///< Append statistics of each frame here as JSON
+  std::string trace_file; ///< Write a Chrome trace of the session here
+  /**
+   * Calibration profile. Empty for calibration_default_path(). The profile is
+   * loaded once per process, so a later render_init() or render_pool keeps
+   * the first one.
+   */
+  std::string calibration_file;
+  /**
+   * Move views straddling the real axis by up to a quarter pixel vertically,
+   * so that the rows above and below the axis mirror each other exactly and
+   * only one of each pair is rendered.
+   */
+  bool align_symmetry = false;
+  /**
+   * Show a preview of blocks of this many pixels square, sampled at one
+   * pixel each, before rendering the rows from the center of the screen out.
+   * 0 or 1 for no preview, rendering the rows spread over the screen.
+   */
+  int coarse_block = 0;
+  /**
+   * Called from the worker threads when a row is complete, with the row and
+   * the generation of its render (see render_generation()).
+   */
+  std::function<void(int row, unsigned int generation)> row_complete;
+};
+
 /// Reconfigure the rendering for a new screen size
 void render_reconfigure(int width, int height);
 
 /// Initialize rendering engine
-void render_init();
+void render_init(const render_options &options = render_options());
 
-/// Stop and clean up rendering engine
+/// Stop and clean up rendering engine. render_init() may be called again.
 void render_stop();
 
-/// Cancel current rendering if any
+/// Wait until the current render is complete
+void render_wait();
+
+/// Cancel current rendering if any. Returns without waiting for the workers.
 void cancel_render();
 
 /// Start rendering
 void start_render();
 
+/**
+ * Generation of the current render. Row completions carry the generation
+ * of their render, so completions from cancelled renders can be told apart.
+ */
+unsigned int render_generation();
+
+/**
+ * Set the row the user looks at, usually the row of the mouse pointer. Rows
+ * not yet started are rendered closest to it first, also in the render in
+ * progress. -1 for the default order.
+ */
+void render_set_focus(int row);
+
 /// Copy pixels from rendering buffer
 void render_copy_pixels(void* dest, size_t offset, size_t length);
 
+/**
+ * Copy a completed row of the current render to the displayed frame. Called
+ * on the thread that displays the frame, when the row completes. Workers
+ * write whole rows under a lock that the copy also takes, so the copy is
+ * always a complete row, possibly of a later pass. The rest of the displayed
+ * frame keeps the previous frame, reprojected to the view of each new render
+ * by start_render().
+ */
+void render_present_row(int row);
+
+/// Copy pixels from the displayed frame
+void render_copy_front(void* dest, size_t offset, size_t length);
+
+/**
+ * Copy smooth iteration counts from rendering buffer. One value per pixel,
+ * row by row; LIMIT for pixels inside the set.
+ */
+void render_copy_iterations(float* dest, size_t offset, size_t count);
+
 const char* render_get_float_type_name();
 
+/// Name of the anti-aliasing mode
+const char* render_get_antialias_name();
+
+/// Statistics of the current frame
+render_stats render_get_stats();
+
 #endif  // _render_hpp
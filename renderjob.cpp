@@ -0,0 +1,193 @@
+#include "renderjob.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+
+#include "affinity.hpp"
+#include "calibration.hpp"
+#include "mandelbrot.hpp"
+#include "renderrow.hpp"
+#include "trace.hpp"
+
+/**
+ * State of one start() of a job. Shared by the job and the queued rows, so a
+ * job can be restarted or destroyed while workers still finish rows of the
+ * previous render; those rows write to the old buffers.
+ */
+struct render_job_state : render_view {
+  render_priority priority; /**< Protected by the mutex of the pool */
+  std::vector<uint32_t> pixels;
+  std::vector<float> iterations;
+  /**
+   * Points of each row that reached the limit, as stored by the row kernel,
+   * so a higher limit can continue them
+   */
+  std::vector<std::shared_ptr<void>> stopped;
+  /**
+   * The stopped points of the previous render when this one only raised the
+   * limit. Only these are iterated; the other pixels are kept.
+   */
+  std::vector<std::shared_ptr<void>> resume;
+  std::atomic_bool cancelled{false};
+  std::atomic_int rows_left;
+  std::mutex mtx;
+  std::condition_variable done_cv;
+};
+
+render_pool::render_pool(int threads) {
+  calibration_load(calibration_default_path());
+  if (threads <= 0) threads = available_cpus().size();
+  for (int i = 0; i < threads; ++i)
+    workers.push_back(std::thread(&render_pool::worker, this));
+}
+
+render_pool::~render_pool() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  work_cv.notify_all();
+  for (auto &t : workers) t.join();
+}
+
+void render_pool::submit(const std::shared_ptr<render_job_state> &job) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (int row = 0; row < job->height; ++row)
+      tasks[job->priority].push_back({job, row});
+  }
+  work_cv.notify_all();
+}
+
+/// Move the queued rows of a job to the queue of another priority
+void render_pool::reprioritize(const std::shared_ptr<render_job_state> &job,
+                               render_priority priority) {
+  std::lock_guard<std::mutex> lock(mtx);
+  if (job->priority == priority) return;
+  std::deque<task> &from = tasks[job->priority];
+  std::deque<task> &to = tasks[priority];
+  auto moved = std::stable_partition(
+      from.begin(), from.end(), [&](const task &t) { return t.job != job; });
+  std::move(moved, from.end(), std::back_inserter(to));
+  from.erase(moved, from.end());
+  job->priority = priority;
+}
+
+void render_pool::worker() {
+  trace_thread_name("pool worker");
+  while (true) {
+    task t;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      std::deque<task> *queue = nullptr;
+      while (!stopping) {
+        for (auto &q : tasks) {
+          if (!q.empty()) {
+            queue = &q;
+            break;
+          }
+        }
+        if (queue) break;
+        work_cv.wait(lock);
+      }
+      if (stopping) return;
+      t = std::move(queue->front());
+      queue->pop_front();
+    }
+    render_job_state &s = *t.job;
+    // Rows of cancelled jobs are dropped as they come up
+    if (s.cancelled) continue;
+    const row_output out{s.pixels.data() + t.row * s.width,
+                         s.iterations.data() + t.row * s.width,
+                         &s.stopped[t.row]};
+    const auto cancelled = [&s] { return s.cancelled.load(); };
+    row_counts counts;
+    const bool complete =
+        s.resume.empty()
+            ? render_view_row(s, t.row, out, counts, cancelled)
+            : render_view_resume_row(s, t.row, s.resume[t.row], out, counts,
+                                     cancelled);
+    if (complete && s.rows_left.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> lock(s.mtx);
+      s.done_cv.notify_all();
+    }
+  }
+}
+
+render_job::render_job(render_pool &pool, int width, int height)
+    : pool(pool), w(width), h(height), iteration_limit(LIMIT) {}
+
+render_job::~render_job() { cancel(); }
+
+void render_job::set_view(const flt &x, const flt &y, const flt &s) {
+  center_x = x;
+  center_y = y;
+  size = s;
+}
+
+void render_job::set_limit(unsigned int limit) { iteration_limit = limit; }
+
+void render_job::set_float_type(FloatType type) { float_type = type; }
+
+void render_job::set_priority(render_priority priority) {
+  job_priority = priority;
+  if (state) pool.reprioritize(state, priority);
+}
+
+void render_job::start() {
+  trace_span span("render_job::start");
+  cancel();
+  auto s = std::make_shared<render_job_state>();
+  s->width = w;
+  s->height = h;
+  s->limit = iteration_limit;
+  s->priority = job_priority;
+  s->pixel_size = size / flt(h);
+  s->min_x = center_x - w * s->pixel_size / flt(2.0);
+  s->min_y = center_y - h * s->pixel_size / flt(2.0);
+  s->stopped.resize(h);
+  s->rows_left = h;
+
+  render_view_prepare(*s, float_type);
+
+  // When only the limit was raised since a completed render, continue its
+  // pixels that reached the old limit rather than starting over
+  if (state && state->rows_left == 0 && state->limit < s->limit &&
+      state->min_x == s->min_x && state->min_y == s->min_y &&
+      state->pixel_size == s->pixel_size &&
+      state->float_type == s->float_type) {
+    s->pixels = state->pixels;
+    s->iterations = state->iterations;
+    s->resume = std::move(state->stopped);
+  } else {
+    s->pixels.resize(w * h);
+    s->iterations.resize(w * h);
+  }
+
+  state = s;
+  if (h > 0) pool.submit(s);
+}
+
+void render_job::cancel() {
+  if (!state) return;
+  state->cancelled = true;
+  std::lock_guard<std::mutex> lock(state->mtx);
+  state->done_cv.notify_all();
+}
+
+void render_job::wait() {
+  if (!state) return;
+  std::unique_lock<std::mutex> lock(state->mtx);
+  while (state->rows_left > 0 && !state->cancelled) state->done_cv.wait(lock);
+}
+
+bool render_job::done() const { return state && state->rows_left == 0; }
+
+const uint32_t *render_job::pixels() const {
+  return state ? state->pixels.data() : nullptr;
+}
+
+const float *render_job::iterations() const {
+  return state ? state->iterations.data() : nullptr;
+}
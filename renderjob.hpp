@@ -0,0 +1,130 @@
+/**
+ * @file renderjob.hpp
+ *
+ * Reentrant rendering API. Unlike the interactive engine in render.hpp, which
+ * renders a single view into global buffers, each render_job has its own
+ * view, buffers, iteration limit and float type, and any number of jobs can
+ * render concurrently on one shared render_pool.
+ */
+
+#ifndef _renderjob_hpp
+#define _renderjob_hpp
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "float.hpp"
+#include "floattype.hpp"
+
+struct render_job_state;
+
+/**
+ * Priority of a job. Workers always take the next row of the most urgent
+ * job, so a job preempts less urgent jobs between two rows.
+ */
+enum render_priority { PRIORITY_INTERACTIVE, PRIORITY_BATCH, PRIORITY_MAX };
+
+/**
+ * Pool of worker threads rendering the rows of render jobs, by priority and
+ * then in the order the jobs were started.
+ */
+class render_pool {
+ public:
+  /// Start the workers. threads is 0 for one per available CPU.
+  explicit render_pool(int threads = 0);
+  /// Stop the workers. Rows still queued are not rendered.
+  ~render_pool();
+  render_pool(const render_pool &) = delete;
+  render_pool &operator=(const render_pool &) = delete;
+
+  /// Number of worker threads
+  int size() const { return workers.size(); }
+
+ private:
+  friend class render_job;
+
+  /// A row of a job to render
+  struct task {
+    std::shared_ptr<render_job_state> job;
+    int row;
+  };
+
+  void submit(const std::shared_ptr<render_job_state> &job);
+  void reprioritize(const std::shared_ptr<render_job_state> &job,
+                    render_priority priority);
+  void worker();
+
+  std::mutex mtx;
+  std::condition_variable work_cv;
+  std::deque<task> tasks[PRIORITY_MAX]; /**< Rows to render by priority */
+  bool stopping = false;
+  std::vector<std::thread> workers;
+};
+
+/**
+ * A render of a single view. Set the view and parameters, then start() and
+ * wait() or poll done(). The results stay valid until the next start(). The
+ * pool must outlive its jobs.
+ */
+class render_job {
+ public:
+  render_job(render_pool &pool, int width, int height);
+  /// Cancels the job. Rows in progress finish in the background.
+  ~render_job();
+  render_job(const render_job &) = delete;
+  render_job &operator=(const render_job &) = delete;
+
+  /// Set the view by its center and height in the complex plane
+  void set_view(const flt &center_x, const flt &center_y, const flt &size);
+  /**
+   * Set the maximum number of iterations per pixel. If only the limit is
+   * raised after a complete render, the next start() continues the pixels
+   * that reached the old limit from where they stopped.
+   */
+  void set_limit(unsigned int limit);
+  /// Set the float type. FT_AUTO selects by the precision needed.
+  void set_float_type(FloatType type);
+  /**
+   * Set the priority. Also applies to the remaining rows of a render in
+   * progress.
+   */
+  void set_priority(render_priority priority);
+
+  /// Start rendering, cancelling any render in progress. Returns at once.
+  void start();
+  /// Cancel the render. Returns without waiting for rows in progress.
+  void cancel();
+  /// Wait until the render is complete or cancelled
+  void wait();
+  /// True if the render is complete
+  bool done() const;
+
+  int width() const { return w; }
+  int height() const { return h; }
+  unsigned int limit() const { return iteration_limit; }
+  render_priority priority() const { return job_priority; }
+
+  /// Colors of the pixels, row by row, 0xRRGGBBAA. nullptr before start().
+  const uint32_t *pixels() const;
+  /// Smooth iteration count of each pixel, row by row; limit() if inside
+  const float *iterations() const;
+
+ private:
+  render_pool &pool;
+  int w;
+  int h;
+  flt center_x{0};
+  flt center_y{0};
+  flt size{4};
+  unsigned int iteration_limit;
+  FloatType float_type = FT_AUTO;
+  render_priority job_priority = PRIORITY_BATCH;
+  std::shared_ptr<render_job_state> state;
+};
+
+#endif  // _renderjob_hpp
@@ -0,0 +1,218 @@
+#include "renderrow.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "calibration.hpp"
+#include "floatdispatch.hpp"
+#include "mandelbrot.hpp"
+#include "palette.hpp"
+
+static const palette pal;
+
+/// Samples per axis of a pixel supersampled near the boundary
+static const int boundary_samples = 4;
+
+void render_view_prepare(render_view &view, FloatType type) {
+  if (type == FT_AUTO) {
+    // The spacing between representable numbers grows with the magnitude,
+    // so the largest coordinate of the view needs the most precision
+    const double y0 = get_double(view.min_y);
+    const double y1 = get_double(view.min_y + view.height * view.pixel_size);
+    const double x0 = get_double(view.min_x);
+    const double x1 = get_double(view.min_x + view.width * view.pixel_size);
+    const double magnitude =
+        std::max(std::max(std::abs(x0), std::abs(x1)),
+                 std::max(std::abs(y0), std::abs(y1)));
+    type = calibration_select_type(view.pixel_size, magnitude);
+  }
+  view.float_type = type;
+  with_float_type(type, [&](auto tag) {
+    using FLT = typename decltype(tag)::type;
+    auto xc = std::make_shared<std::vector<FLT>>(view.width);
+    for (int col = 0; col < view.width; ++col)
+      (*xc)[col] = FLT(view.min_x + col * view.pixel_size);
+    view.column_x = xc;
+  });
+}
+
+/// A pixel that reached the limit
+template <typename FLT>
+struct stopped {
+  int col;
+  iter_state<FLT> state;
+};
+
+/// Store the result of a pixel, and its state if it reached the limit
+template <typename FLT>
+static void store_pixel(const render_view &v, int col,
+                        const iter_result<FLT> &result,
+                        const iter_state<FLT> &state, const row_output &out,
+                        std::vector<stopped<FLT>> &row_stopped,
+                        row_counts &counts) {
+  if (result.iterations == v.limit) {
+    out.pixels[col] = 0x00;
+    out.iterations[col] = v.limit;
+    if (out.stopped) row_stopped.push_back({col, state});
+  } else {
+    ++counts.escaped;
+    const double sum = result.iterations + fraction(result.x, result.y);
+    out.iterations[col] = float(sum);
+    out.pixels[col] = pal.color(sum);
+  }
+}
+
+template <typename FLT>
+static bool render_rowx(const render_view &v, int row, const row_output &out,
+                        row_counts &counts,
+                        const render_cancelled &cancelled) {
+  const std::vector<FLT> &xc = render_view_columns<FLT>(v);
+  const FLT yc = FLT(v.min_y + row * v.pixel_size);
+  auto row_stopped = std::make_shared<std::vector<stopped<FLT>>>();
+  interior_cycle<FLT> cycle;
+  iter_state<FLT> state;
+  int col = 0;
+  for (; col < v.width; ++col) {
+    if (v.predict_interior && isinside(xc[col], yc, cycle)) {
+      ++counts.predicted;
+      // Inside whatever the limit, so never iterated when resumed
+      store_pixel(v, col, iter_result<FLT>{v.limit, FLT(0), FLT(0)},
+                  iter_state<FLT>{FLT(0), FLT(0), 0, true}, out,
+                  *row_stopped, counts);
+      continue;
+    }
+    auto result = iter(xc[col], yc, v.limit, &state);
+    if (cancelled()) break;
+    counts.iterations += result.iterations;
+    if (result.iterations == v.limit) {
+      // The cycle is tried for the following pixels
+      if (v.predict_interior) find_cycle(xc[col], yc, state, cycle);
+    } else {
+      cycle.period = 0;
+    }
+    store_pixel(v, col, result, state, out, *row_stopped, counts);
+  }
+  counts.pixels += col;
+  if (col < v.width) return false;
+  if (out.stopped) *out.stopped = row_stopped;
+  return true;
+}
+
+bool render_view_row(const render_view &view, int row, const row_output &out,
+                     row_counts &counts, const render_cancelled &cancelled) {
+  bool complete = false;
+  with_float_type(view.float_type, [&](auto tag) {
+    using FLT = typename decltype(tag)::type;
+    complete = render_rowx<FLT>(view, row, out, counts, cancelled);
+  });
+  return complete;
+}
+
+/**
+ * Color of an escaped point that is distance pixels from the set. Points
+ * within a pixel of the set are faded towards the interior color, which
+ * brings out filaments too thin to be hit by any sample.
+ */
+static uint32_t distance_color(double sum, double distance) {
+  return blend(pal.color(sum), 0x00, std::min(1.0, distance));
+}
+
+template <typename FLT>
+static bool render_rowx_de(const render_view &v, int row,
+                           const row_output &out, row_counts &counts,
+                           const render_cancelled &cancelled) {
+  const std::vector<FLT> &xc = render_view_columns<FLT>(v);
+  const FLT yc = FLT(v.min_y + row * v.pixel_size);
+  const FLT size = FLT(v.pixel_size);
+  const double pixel = get_double(v.pixel_size);
+  int col = 0;
+  for (; col < v.width; ++col) {
+    auto result = iter_de(xc[col], yc, v.limit);
+    if (cancelled()) break;
+    counts.iterations += result.iterations;
+    if (result.iterations == v.limit) {
+      out.pixels[col] = 0x00;
+      out.iterations[col] = v.limit;
+      continue;
+    }
+    ++counts.escaped;
+    const double sum = result.iterations + fraction(result.x, result.y);
+    out.iterations[col] = float(sum);
+    if (result.distance >= pixel) {
+      out.pixels[col] = pal.color(sum);
+      continue;
+    }
+
+    ++counts.supersampled;
+    color_sum samples;
+    for (int sy = 0; sy < boundary_samples; ++sy) {
+      const FLT y = yc + FLT((sy + 0.5) / boundary_samples - 0.5) * size;
+      for (int sx = 0; sx < boundary_samples; ++sx) {
+        const FLT x =
+            xc[col] + FLT((sx + 0.5) / boundary_samples - 0.5) * size;
+        auto sample = iter_de(x, y, v.limit);
+        counts.iterations += sample.iterations;
+        samples.add(sample.iterations == v.limit
+                        ? 0x00
+                        : distance_color(sample.iterations +
+                                             fraction(sample.x, sample.y),
+                                         sample.distance / pixel));
+      }
+    }
+    out.pixels[col] = samples.average(boundary_samples * boundary_samples);
+  }
+  counts.pixels += col;
+  return col == v.width;
+}
+
+bool render_view_row_de(const render_view &view, int row,
+                        const row_output &out, row_counts &counts,
+                        const render_cancelled &cancelled) {
+  bool complete = false;
+  with_float_type(view.float_type, [&](auto tag) {
+    using FLT = typename decltype(tag)::type;
+    complete = render_rowx_de<FLT>(view, row, out, counts, cancelled);
+  });
+  return complete;
+}
+
+template <typename FLT>
+static bool resume_rowx(const render_view &v, int row,
+                        const std::shared_ptr<void> &resume,
+                        const row_output &out, row_counts &counts,
+                        const render_cancelled &cancelled) {
+  const std::vector<FLT> &xc = render_view_columns<FLT>(v);
+  const FLT yc = FLT(v.min_y + row * v.pixel_size);
+  const auto &points =
+      *static_cast<const std::vector<stopped<FLT>> *>(resume.get());
+  auto row_stopped = std::make_shared<std::vector<stopped<FLT>>>();
+  iter_state<FLT> state;
+  for (const stopped<FLT> &point : points) {
+    if (point.state.inside) {
+      // Known to be inside, whatever the limit
+      store_pixel(v, point.col, iter_result<FLT>{v.limit, FLT(0), FLT(0)},
+                  point.state, out, *row_stopped, counts);
+      continue;
+    }
+    auto result =
+        iter_continue(xc[point.col], yc, point.state, v.limit, &state);
+    if (cancelled()) return false;
+    counts.iterations += result.iterations - point.state.iterations;
+    store_pixel(v, point.col, result, state, out, *row_stopped, counts);
+  }
+  counts.pixels += points.size();
+  if (out.stopped) *out.stopped = row_stopped;
+  return true;
+}
+
+bool render_view_resume_row(const render_view &view, int row,
+                            const std::shared_ptr<void> &resume,
+                            const row_output &out, row_counts &counts,
+                            const render_cancelled &cancelled) {
+  bool complete = false;
+  with_float_type(view.float_type, [&](auto tag) {
+    using FLT = typename decltype(tag)::type;
+    complete = resume_rowx<FLT>(view, row, resume, out, counts, cancelled);
+  });
+  return complete;
+}
@@ -0,0 +1,123 @@
+/**
+ * @file renderrow.hpp
+ *
+ * Rendering of the rows of a view, shared by the interactive engine in
+ * render.cpp and the render jobs of renderjob.cpp. Each of them schedules
+ * the rows and owns the buffers; the selection of the float type, the
+ * column coordinates and the row kernels are the same.
+ */
+
+#ifndef _renderrow_hpp
+#define _renderrow_hpp
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "float.hpp"
+#include "floattype.hpp"
+
+/// A view of the complex plane, rendered row by row in a single float type
+struct render_view {
+  int width = 0;
+  int height = 0;
+  flt min_x;
+  flt min_y;
+  flt pixel_size;
+  unsigned int limit = 0; /**< Maximum number of iterations per pixel */
+  /**
+   * Recognize interior pixels by the attracting cycle found for the previous
+   * pixel of the row, instead of iterating them up to the limit
+   */
+  bool predict_interior = false;
+  FloatType float_type = FT_AUTO; /**< Set by render_view_prepare() */
+  /**
+   * X coordinate of each column as a std::vector<FLT> of float_type. The
+   * same for every row, so computed once at full precision and shared
+   * read-only by all workers.
+   */
+  std::shared_ptr<const void> column_x;
+};
+
+/**
+ * Set the float type of a view, or with FT_AUTO select the fastest type
+ * precise enough for its pixel size and the largest coordinate magnitude of
+ * the view, and compute the column coordinates. FT_AUTO requires
+ * calibration_load().
+ */
+void render_view_prepare(render_view &view, FloatType type);
+
+/// Column coordinates of a view whose float type is FLT
+template <typename FLT>
+const std::vector<FLT> &render_view_columns(const render_view &view) {
+  return *static_cast<const std::vector<FLT> *>(view.column_x.get());
+}
+
+/// Work done on a row, for the statistics
+struct row_counts {
+  int pixels = 0; /**< Pixels done, also of a cancelled row */
+  int escaped = 0;
+  int predicted = 0; /**< Recognized as interior by the cycle of a neighbor */
+  int supersampled = 0;
+  uint64_t iterations = 0;
+};
+
+/// Where a row kernel writes a row
+struct row_output {
+  uint32_t *pixels;  /**< Colors, 0xRRGGBBAA */
+  float *iterations; /**< Smooth iteration counts; the limit if inside */
+  /**
+   * If not null, receives the points of a completed row that reached the
+   * limit, for render_view_resume_row() to continue with a higher limit
+   */
+  std::shared_ptr<void> *stopped = nullptr;
+};
+
+/**
+ * Polled by the row kernels after each pixel, so a cancel does not wait for
+ * slow rows to finish. Returns true if the render was cancelled.
+ */
+using render_cancelled = std::function<bool()>;
+
+/**
+ * Render a row of a view. Returns false if the render was cancelled before
+ * the row was complete.
+ */
+bool render_view_row(const render_view &view, int row, const row_output &out,
+                     row_counts &counts, const render_cancelled &cancelled);
+
+/**
+ * Render a row using distance estimation. Pixels further than a pixel from
+ * the set get a single sample; pixels closer are supersampled, so the extra
+ * work is spent only where the image has detail. Stores no stopped points.
+ */
+bool render_view_row_de(const render_view &view, int row,
+                        const row_output &out, row_counts &counts,
+                        const render_cancelled &cancelled);
+
+/**
+ * Continue the points of a row that reached the limit of a previous render
+ * of the same view and float type, as stored through row_output::stopped,
+ * up to the limit of view. The other pixels of out are left alone.
+ */
+bool render_view_resume_row(const render_view &view, int row,
+                            const std::shared_ptr<void> &resume,
+                            const row_output &out, row_counts &counts,
+                            const render_cancelled &cancelled);
+
+/// Sum of colors, for averaging samples
+struct color_sum {
+  float channel[4] = {};
+  void add(uint32_t color) {
+    for (int i = 0; i < 4; ++i) channel[i] += (color >> (24 - 8 * i)) & 0xff;
+  }
+  uint32_t average(int count) const {
+    uint32_t color = 0;
+    for (int i = 0; i < 4; ++i)
+      color |= uint32_t(channel[i] / count + 0.5f) << (24 - 8 * i);
+    return color;
+  }
+};
+
+#endif  // _renderrow_hpp
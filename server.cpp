@@ -0,0 +1,215 @@
+/**
+ * @file server.cpp
+ *
+ * Local render server. Renders tiles requested over a Unix socket on a shared
+ * render_pool, for viewers running in another process.
+ *
+ * Each request is a single line:
+ *
+ *     PRIORITY FORMAT WIDTH HEIGHT LIMIT CENTER_X CENTER_Y SIZE
+ *
+ * PRIORITY is "interactive" or "batch", and LIMIT is from 1 to max_limit.
+ * FORMAT is "rgba" for 0xRRGGBBAA pixels or "iterations" for smooth
+ * iteration counts as 32 bit floats, LIMIT inside the set. Both are in host
+ * byte order, row by row. The reply is a line "ok BYTES" followed by the
+ * data, or a line "error MESSAGE". A connection may send any number of
+ * requests; replies are sent in order.
+ *
+ * Identical tiles requested while one is already being rendered share the
+ * render, whatever their priority and format. Interactive tiles preempt
+ * batch tiles between rows, and a batch tile is promoted when an identical
+ * interactive tile is requested.
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "netio.hpp"
+#include "renderjob.hpp"
+#include "strop.hpp"
+
+/// Options from the command line
+struct server_options {
+  std::string socket_path;
+  int threads = 0;
+};
+
+/// Largest tile accepted, in pixels
+static const int max_tile_pixels = 4096 * 4096;
+
+/**
+ * Largest iteration limit accepted. Coalesced requests wait for each other,
+ * so a single request must not hold the pool indefinitely.
+ */
+static const long max_limit = 1 << 20;
+
+/// A parsed request
+struct tile_request {
+  render_priority priority;
+  bool iterations; /**< Reply with iterations instead of pixels */
+  int width;
+  int height;
+  unsigned int limit;
+  flt center_x;
+  flt center_y;
+  flt size;
+  /// Identifies identical renders, regardless of priority and format
+  std::string key;
+};
+
+/// A tile being rendered, shared by all requests for it
+struct tile_render {
+  tile_render(render_pool &pool, const tile_request &req)
+      : job(pool, req.width, req.height) {}
+  render_job job;
+};
+
+static render_pool *pool = nullptr;
+static std::mutex in_flight_mutex;
+static std::map<std::string, std::shared_ptr<tile_render>> in_flight;
+
+static tile_request parse_request(const std::string &line) {
+  std::istringstream is(line);
+  std::string priority, format;
+  tile_request req;
+  std::string limit;
+  is >> priority >> format >> req.width >> req.height >> limit;
+  // Keep the coordinates as text for the key, so identical requests are
+  // recognized without comparing floats
+  std::string x, y, size;
+  is >> x >> y >> size;
+  if (!is) throw std::runtime_error("malformed request");
+  if (priority == "interactive")
+    req.priority = PRIORITY_INTERACTIVE;
+  else if (priority == "batch")
+    req.priority = PRIORITY_BATCH;
+  else
+    throw std::runtime_error("unknown priority " + priority);
+  if (format != "rgba" && format != "iterations")
+    throw std::runtime_error("unknown format " + format);
+  req.iterations = format == "iterations";
+  if (req.width <= 0 || req.height <= 0 ||
+      req.width > max_tile_pixels / req.height)
+    throw std::runtime_error("invalid tile size");
+  // Signed, so that a negative limit is rejected instead of wrapping around
+  long parsed_limit;
+  if (!parse_number(limit, parsed_limit) || parsed_limit < 1 ||
+      parsed_limit > max_limit)
+    throw std::runtime_error("invalid limit");
+  req.limit = parsed_limit;
+  if (!parse_number(x, req.center_x) || !parse_number(y, req.center_y) ||
+      !parse_number(size, req.size))
+    throw std::runtime_error("malformed coordinates");
+  std::ostringstream key;
+  key << req.width << " " << req.height << " " << req.limit << " " << x << " "
+      << y << " " << size;
+  req.key = key.str();
+  return req;
+}
+
+/**
+ * Render a tile, or join the render of an identical tile in flight. Returns
+ * once the tile is complete.
+ */
+static std::shared_ptr<tile_render> render_tile(const tile_request &req) {
+  std::shared_ptr<tile_render> tile;
+  {
+    std::lock_guard<std::mutex> lock(in_flight_mutex);
+    auto it = in_flight.find(req.key);
+    if (it != in_flight.end()) {
+      tile = it->second;
+      if (req.priority < tile->job.priority())
+        tile->job.set_priority(req.priority);
+    } else {
+      tile = std::make_shared<tile_render>(*pool, req);
+      tile->job.set_view(req.center_x, req.center_y, req.size);
+      tile->job.set_limit(req.limit);
+      tile->job.set_priority(req.priority);
+      tile->job.start();
+      in_flight[req.key] = tile;
+    }
+  }
+  tile->job.wait();
+  {
+    std::lock_guard<std::mutex> lock(in_flight_mutex);
+    auto it = in_flight.find(req.key);
+    if (it != in_flight.end() && it->second == tile) in_flight.erase(it);
+  }
+  return tile;
+}
+
+/// Serve the requests of a connection until it is closed
+static void serve_connection(int fd) {
+  socket_reader reader(fd);
+  std::string line;
+  while (reader.read_line(line)) {
+    bool ok;
+    try {
+      const tile_request req = parse_request(line);
+      auto tile = render_tile(req);
+      const void *data = req.iterations
+                             ? static_cast<const void *>(tile->job.iterations())
+                             : static_cast<const void *>(tile->job.pixels());
+      const size_t length = size_t(req.width) * req.height * 4;
+      const std::string header = "ok " + std::to_string(length) + "\n";
+      ok = write_all(fd, header.data(), header.size()) &&
+           write_all(fd, data, length);
+    } catch (const std::exception &exc) {
+      const std::string reply = std::string("error ") + exc.what() + "\n";
+      ok = write_all(fd, reply.data(), reply.size());
+    }
+    if (!ok) break;
+  }
+  close(fd);
+}
+
+static server_options parse_options(int argc, char **argv) {
+  server_options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--socket" && i + 1 < argc) {
+      options.socket_path = argv[++i];
+    } else if (arg == "--threads" && i + 1 < argc) {
+      options.threads = std::stoi(argv[++i]);
+    } else {
+      throw std::runtime_error("usage: " + std::string(argv[0]) +
+                               " --socket PATH [--threads N]");
+    }
+  }
+  if (options.socket_path.empty())
+    throw std::runtime_error("missing --socket PATH");
+  return options;
+}
+
+int main(int argc, char **argv) {
+  try {
+    const server_options options = parse_options(argc, argv);
+    render_pool render_workers(options.threads);
+    pool = &render_workers;
+    const int listen_fd = listen_unix(options.socket_path);
+    std::cout << "serving on " << options.socket_path << " with "
+              << render_workers.size() << " workers" << std::endl;
+    while (true) {
+      int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) {
+        if (errno == EINTR) continue;
+        throw std::runtime_error("accept: " + std::string(strerror(errno)));
+      }
+      std::thread(serve_connection, fd).detach();
+    }
+  } catch (const std::exception &exc) {
+    std::cerr << exc.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
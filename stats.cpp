@@ -0,0 +1,33 @@
+/**
+ * @file stats.cpp
+ */
+
+#include "stats.hpp"
+
+void write_json(std::ostream &os, const render_stats &stats) {
+  os << "{\"elapsed_ms\":" << stats.elapsed_ms << ",\"rows\":" << stats.rows
+     << ",\"pixels\":" << stats.pixels << ",\"escaped\":" << stats.escaped
+     << ",\"interior\":" << stats.interior
+     << ",\"supersampled\":" << stats.supersampled
+     << ",\"mirrored\":" << stats.mirrored
+     << ",\"predicted\":" << stats.predicted
+     << ",\"iterations\":" << stats.iterations
+     << ",\"queue_wait_ms\":" << stats.queue_wait_ms
+     << ",\"cancel_latency_ms\":" << stats.cancel_latency_ms
+     << ",\"type_ms\":{";
+  const char *sep = "";
+  for (int type = FT_AUTO + 1; type < FT_MAX; ++type) {
+    if (stats.type_ms[type] == 0.0) continue;
+    os << sep << '"' << floattypenames[type] << "\":" << stats.type_ms[type];
+    sep = ",";
+  }
+  os << "},\"threads\":[";
+  sep = "";
+  for (const auto &thread : stats.threads) {
+    os << sep << "{\"rows\":" << thread.rows
+       << ",\"busy_ms\":" << thread.busy_ms
+       << ",\"idle_ms\":" << thread.idle_ms << '}';
+    sep = ",";
+  }
+  os << "]}\n";
+}
@@ -0,0 +1,100 @@
+/**
+ * @file stats.hpp
+ *
+ * Render engine instrumentation.
+ */
+
+#ifndef _stats_hpp
+#define _stats_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "floattype.hpp"
+
+/// Plain copy of the counters of a worker
+struct counter_values {
+  uint64_t rows;
+  uint64_t pixels;
+  uint64_t escaped;
+  uint64_t supersampled;
+  uint64_t mirrored;
+  uint64_t predicted;
+  uint64_t iterations;
+  uint64_t busy_ns;
+  uint64_t idle_ns;
+  uint64_t queue_wait_ns;
+  uint64_t type_ns[FT_MAX];
+};
+
+/**
+ * Cumulative counters of a single worker. Only written by the worker itself,
+ * so updates are plain relaxed load/store pairs. Cache line aligned to avoid
+ * false sharing between workers.
+ */
+struct alignas(64) worker_counters {
+  std::atomic<uint64_t> rows{0};
+  std::atomic<uint64_t> pixels{0};
+  std::atomic<uint64_t> escaped{0};
+  std::atomic<uint64_t> supersampled{0};
+  std::atomic<uint64_t> mirrored{0};
+  std::atomic<uint64_t> predicted{0};
+  std::atomic<uint64_t> iterations{0};
+  std::atomic<uint64_t> busy_ns{0};
+  std::atomic<uint64_t> idle_ns{0};
+  std::atomic<uint64_t> queue_wait_ns{0};
+  std::atomic<uint64_t> type_ns[FT_MAX] = {};
+
+  static void add(std::atomic<uint64_t> &counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+
+  counter_values read() const {
+    counter_values v;
+    v.rows = rows.load(std::memory_order_relaxed);
+    v.pixels = pixels.load(std::memory_order_relaxed);
+    v.escaped = escaped.load(std::memory_order_relaxed);
+    v.supersampled = supersampled.load(std::memory_order_relaxed);
+    v.mirrored = mirrored.load(std::memory_order_relaxed);
+    v.predicted = predicted.load(std::memory_order_relaxed);
+    v.iterations = iterations.load(std::memory_order_relaxed);
+    v.busy_ns = busy_ns.load(std::memory_order_relaxed);
+    v.idle_ns = idle_ns.load(std::memory_order_relaxed);
+    v.queue_wait_ns = queue_wait_ns.load(std::memory_order_relaxed);
+    for (int type = 0; type < FT_MAX; ++type)
+      v.type_ns[type] = type_ns[type].load(std::memory_order_relaxed);
+    return v;
+  }
+};
+
+/// Statistics of a single worker for a frame
+struct thread_stats {
+  uint64_t rows;
+  double busy_ms;
+  double idle_ms;
+};
+
+/// Statistics of the current frame
+struct render_stats {
+  double elapsed_ms;        /**< Time since the render started */
+  uint64_t rows;            /**< Rows rendered */
+  uint64_t pixels;          /**< Pixels rendered */
+  uint64_t escaped;         /**< Pixels that escaped */
+  uint64_t interior;        /**< Pixels that reached the iteration limit */
+  uint64_t supersampled;    /**< Pixels that took more than one sample */
+  uint64_t mirrored;        /**< Rows copied from their mirror image */
+  uint64_t predicted;       /**< Interior pixels found without iterating */
+  uint64_t iterations;      /**< Total iterations */
+  double queue_wait_ms;     /**< Average time a row waited to be taken */
+  double cancel_latency_ms; /**< Time for the previous render to drain */
+  double type_ms[FT_MAX];   /**< Busy time per float type */
+  std::vector<thread_stats> threads;
+};
+
+/// Write statistics as a single line JSON object
+void write_json(std::ostream &os, const render_stats &stats);
+
+#endif  // _stats_hpp
@@ -7,7 +7,11 @@
 #ifndef _strop_hpp
 #define _strop_hpp
 
+#include <sstream>
+#include <string>
+
 #include "doubledouble.hpp"
+#include "floatexp.hpp"
 #include "gmpfloat.hpp"
 #include "mpfrfloat.hpp"
 
@@ -45,7 +49,8 @@ template <mp_bitcnt_t PREC>
 std::istream& operator>>(std::istream& os, gmpfloat<PREC>& rhs) {
   std::string str;
   os >> str;
-  mpf_set_str(rhs.mpf, str.c_str(), 10);
+  if (os && mpf_set_str(rhs.mpf, str.c_str(), 10) != 0)
+    os.setstate(std::ios::failbit);
   return os;
 }
 
@@ -61,7 +66,8 @@ template <int PREC, mpfr_rnd_t RND>
 std::istream& operator>>(std::istream& os, mpfrfloat<PREC, RND>& rhs) {
   std::string str;
   os >> str;
-  mpfr_set_str(rhs.mpfr, str.c_str(), 10, RND);
+  if (os && mpfr_set_str(rhs.mpfr, str.c_str(), 10, RND) != 0)
+    os.setstate(std::ios::failbit);
   return os;
 }
 
@@ -78,6 +84,23 @@ std::istream& operator>>(std::istream& os, doubledouble<FLT>& rhs) {
   return os;
 }
 
+/// Through MPFR, which has the range of floatexp
+inline std::ostream& operator<<(std::ostream& os, const floatexp& rhs) {
+  mpfrfloat<std::numeric_limits<double>::digits, MPFR_RNDN> flt;
+  mpfr_set_d(flt.mpfr, rhs.m, MPFR_RNDN);
+  mpfr_mul_2si(flt.mpfr, flt.mpfr, long(rhs.e), MPFR_RNDN);
+  return os << flt;
+}
+
+inline std::istream& operator>>(std::istream& os, floatexp& rhs) {
+  mpfrfloat<std::numeric_limits<double>::digits, MPFR_RNDN> flt;
+  os >> flt;
+  long exp;
+  const double m = mpfr_get_d_2exp(&exp, flt.mpfr, MPFR_RNDN);
+  rhs = floatexp(m, exp);
+  return os;
+}
+
 inline std::ostream& operator<<(std::ostream& os, const __float128& rhs) {
   return os << gmpfloat<113>(rhs);
 }
@@ -89,4 +112,14 @@ inline std::istream& operator>>(std::istream& os, __float128& rhs) {
   return os;
 }
 
+/**
+ * Parse a number that makes up the whole string. Returns false if the string
+ * is not a number or has anything but white space after it.
+ */
+template <typename FLT>
+bool parse_number(const std::string& str, FLT& value) {
+  std::istringstream is(str);
+  return (is >> value) && (is >> std::ws).eof();
+}
+
 #endif  // _strop_hpp
@@ -0,0 +1,119 @@
+/**
+ * @file trace.cpp
+ */
+
+#include "trace.hpp"
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+bool trace_enabled = false;
+
+/// A recorded event
+struct trace_event {
+  const char *name;
+  const char *detail;
+  char phase;
+  int64_t arg;
+  trace_clock::time_point start;
+  trace_clock::duration duration;
+};
+
+/// Events of a single thread. Only written by the thread itself.
+struct trace_buffer {
+  int tid;
+  const char *name = nullptr;
+  std::vector<trace_event> events;
+  size_t next = 0;
+  bool wrapped = false;
+};
+
+static size_t trace_capacity;
+static trace_clock::time_point trace_epoch;
+static std::mutex buffers_mutex;
+static std::vector<std::unique_ptr<trace_buffer>> buffers;
+static thread_local trace_buffer *local_buffer = nullptr;
+
+void trace_start(size_t capacity) {
+  trace_capacity = capacity;
+  trace_epoch = trace_clock::now();
+  trace_enabled = true;
+}
+
+/// Ring buffer of the calling thread, created on first use
+static trace_buffer &buffer() {
+  if (local_buffer == nullptr) {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    buffers.emplace_back(new trace_buffer);
+    local_buffer = buffers.back().get();
+    local_buffer->tid = buffers.size();
+    local_buffer->events.resize(trace_capacity);
+  }
+  return *local_buffer;
+}
+
+static void record(const trace_event &event) {
+  trace_buffer &buf = buffer();
+  buf.events[buf.next] = event;
+  if (++buf.next == buf.events.size()) {
+    buf.next = 0;
+    buf.wrapped = true;
+  }
+}
+
+void trace_thread_name(const char *name) {
+  if (trace_enabled) buffer().name = name;
+}
+
+void trace_complete(const char *name, trace_clock::time_point start,
+                    int64_t arg, const char *detail) {
+  if (!trace_enabled) return;
+  record(trace_event{name, detail, 'X', arg, start, trace_clock::now() - start});
+}
+
+void trace_instant(const char *name, int64_t arg) {
+  if (!trace_enabled) return;
+  record(trace_event{name, nullptr, 'i', arg, trace_clock::now(),
+                     trace_clock::duration::zero()});
+}
+
+/// Microseconds as used for timestamps in the trace format
+static double us(trace_clock::duration d) {
+  return std::chrono::duration<double, std::micro>(d).count();
+}
+
+void trace_write(const std::string &path) {
+  std::ofstream of(path);
+  std::lock_guard<std::mutex> lock(buffers_mutex);
+  of << "{\"traceEvents\":[\n";
+  const char *sep = "";
+  for (const auto &buf : buffers) {
+    if (buf->name) {
+      of << sep << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+         << buf->tid << ",\"args\":{\"name\":\"" << buf->name << "\"}}";
+      sep = ",\n";
+    }
+    const size_t count = buf->wrapped ? buf->events.size() : buf->next;
+    const size_t first = buf->wrapped ? buf->next : 0;
+    for (size_t i = 0; i < count; ++i) {
+      const trace_event &e = buf->events[(first + i) % buf->events.size()];
+      of << sep << "{\"name\":\"" << e.name << "\",\"ph\":\"" << e.phase
+         << "\",\"pid\":1,\"tid\":" << buf->tid
+         << ",\"ts\":" << us(e.start - trace_epoch);
+      if (e.phase == 'X') of << ",\"dur\":" << us(e.duration);
+      if (e.phase == 'i') of << ",\"s\":\"t\"";
+      if (e.arg >= 0 || e.detail) {
+        of << ",\"args\":{";
+        if (e.arg >= 0) of << "\"arg\":" << e.arg;
+        if (e.arg >= 0 && e.detail) of << ',';
+        if (e.detail) of << "\"detail\":\"" << e.detail << '"';
+        of << '}';
+      }
+      of << '}';
+      sep = ",\n";
+    }
+  }
+  of << "\n]}\n";
+}
@@ -0,0 +1,66 @@
+/**
+ * @file trace.hpp
+ *
+ * Timeline tracing of render and display activity in Chrome trace event
+ * format, viewable in chrome://tracing or Perfetto.
+ */
+
+#ifndef _trace_hpp
+#define _trace_hpp
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using trace_clock = std::chrono::steady_clock;
+
+/// Set when tracing is enabled. Checked before doing any tracing work.
+extern bool trace_enabled;
+
+/**
+ * Enable tracing. Must be called before any other threads record events.
+ * Each thread keeps the last capacity events in a ring buffer.
+ */
+void trace_start(size_t capacity);
+
+/// Name the calling thread in the trace
+void trace_thread_name(const char *name);
+
+/**
+ * Record an event that started at start and ends now. name and detail must
+ * be string literals or otherwise outlive the trace. A negative arg is
+ * omitted.
+ */
+void trace_complete(const char *name, trace_clock::time_point start,
+                    int64_t arg = -1, const char *detail = nullptr);
+
+/// Record an instant event
+void trace_instant(const char *name, int64_t arg = -1);
+
+/**
+ * Write all recorded events to file. The threads that recorded them must
+ * have finished or be idle.
+ */
+void trace_write(const std::string &path);
+
+/// Records a complete event covering the lifetime of the object
+class trace_span {
+ public:
+  explicit trace_span(const char *name, int64_t arg = -1)
+      : name(name), arg(arg) {
+    if (trace_enabled) start = trace_clock::now();
+  }
+  ~trace_span() {
+    if (trace_enabled) trace_complete(name, start, arg);
+  }
+  trace_span(const trace_span &) = delete;
+  trace_span &operator=(const trace_span &) = delete;
+
+ private:
+  const char *name;
+  int64_t arg;
+  trace_clock::time_point start;
+};
+
+#endif  // _trace_hpp
@@ -1,6 +1,8 @@
 #ifndef _typename_hpp
 #define _typename_hpp
 
+#include "floatexp.hpp"
+
 template <typename T>
 const char* tname() {
   return typeid(T).name();
@@ -46,6 +48,11 @@ const char* tname<doubledouble<__float128>>() {
   return "doubledouble<__float128>";
 }
 
+template <>
+const char* tname<floatexp>() {
+  return "floatexp";
+}
+
 template <>
 const char* tname<gmpfloat<128>>() {
   return "gmpfloat<128>";
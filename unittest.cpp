@@ -3,10 +3,16 @@
 #include "typenames.hpp"
 // #include "format.hpp"
 #include <cmath>
+#include <filesystem>
+#include <fstream>
 #include <limits>
 #include <sstream>
 
+#include "bookmark.hpp"
+#include "exact.hpp"
 #include "floatext.hpp"
+#include "mandelbrot.hpp"
+#include "nucleus.hpp"
 #include "strop.hpp"
 
 static unsigned int assert_count = 0;
@@ -83,6 +89,273 @@ void test_gmpfloat() {
          gmpfloat<1024>(1.0));
 }
 
+/**
+ * floatexp must round like double within the range of double, and keep
+ * computing beyond it.
+ */
+void test_floatexp() {
+  int differing = 0;
+  for (double y = -1.0; y <= 1.0; y += 0.125) {
+    for (double x = -2.0; x <= 0.5; x += 0.125) {
+      auto d = iter(x, y);
+      auto f = iter(floatexp(x), floatexp(y));
+      if (f.iterations != d.iterations || get_double(f.x) != d.x ||
+          get_double(f.y) != d.y)
+        ++differing;
+    }
+  }
+  assert(differing == 0);
+
+  const floatexp tiny(1e-300);
+  const floatexp cube = tiny * tiny * tiny;
+  assert(get_double(cube) == 0.0 && cube > 0.0);
+  assert(std::abs(get_double(cube / tiny / tiny) / 1e-300 - 1.0) < 1e-15);
+  assert(cube + tiny == tiny && cube - cube == floatexp(0.0));
+  assert(cube < tiny && -tiny < -cube && -cube < cube);
+  assert(std::abs(-cube) == cube);
+  assert(floatexp(5e-324) * floatexp(1.0, 1074) == floatexp(1.0));
+
+  std::ostringstream os;
+  os.precision(std::numeric_limits<double>::max_digits10);
+  os << cube;
+  floatexp read;
+  std::istringstream(os.str()) >> read;
+  assert(read == cube);
+}
+
+/// The exact text and binary forms must round trip without loss
+template <typename FLT>
+void test_exact() {
+  const FLT values[] = {FLT(0), FLT(1) / FLT(3), FLT(-2) / FLT(7) * FLT(1e-30),
+                        FLT(1e30) / FLT(3)};
+  for (const FLT &value : values) {
+    FLT parsed{1};
+    assert_flt(parse_exact(exact_string(value), parsed));
+    assert_flt(parsed == value);
+    std::stringstream binary;
+    write_parts(binary, to_parts(value));
+    exact_parts parts;
+    assert_flt(read_parts(binary, parts));
+    from_parts(parts, parsed);
+    assert_flt(parsed == value);
+    // Across types: exact into a wider type and back
+    gmpfloat<512> wide;
+    assert_flt(parse_exact(exact_string(value), wide));
+    assert_flt(parse_exact(exact_string(wide), parsed));
+    assert_flt(parsed == value);
+  }
+  FLT parsed;
+  assert_flt(!parse_exact("1.8p+1junk", parsed));
+  assert_flt(!parse_exact("18", parsed));
+}
+
+/// A low part far below the high part must survive, also when negative
+void test_exact_gap() {
+  const doubledouble<double> gap(1.0, -0x1p-200);
+  doubledouble<double> parsed;
+  assert(parse_exact(exact_string(gap), parsed));
+  assert(parsed.r == gap.r && parsed.e == gap.e);
+}
+
+/// Positions must round trip, and other versions must be rejected
+void test_bookmark() {
+  view_position pos{flt(-1) / flt(3), flt(2) / flt(7), flt(1e-40) / flt(3)};
+  view_position parsed{flt(0), flt(0), flt(0)};
+  assert(position_from_text(position_to_text(pos), parsed));
+  assert(parsed.center_x == pos.center_x && parsed.center_y == pos.center_y &&
+         parsed.size == pos.size);
+  std::string text = position_to_text(pos);
+  text.replace(text.find(" 1 "), 3, " 2 ");
+  assert(!position_from_text(text, parsed));
+
+  std::stringstream binary;
+  write_position(binary, pos);
+  parsed = view_position{flt(0), flt(0), flt(0)};
+  assert(read_position(binary, parsed));
+  assert(parsed.center_x == pos.center_x && parsed.center_y == pos.center_y &&
+         parsed.size == pos.size);
+  std::string data = binary.str();
+  data[3] = 2;
+  std::stringstream other_version(data);
+  assert(!read_position(other_version, parsed));
+}
+
+/**
+ * Saving keeps the other slots. A malformed file must be left alone instead
+ * of being rewritten without the slots that could not be read.
+ */
+void test_bookmark_file() {
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "mandelbrot-unittest-bookmarks")
+          .string();
+  std::filesystem::remove(path);
+  const view_position first{flt(-0.75), flt(0.1), flt(1e-3)};
+  const view_position second{flt(0.25), flt(0), flt(2)};
+  view_position loaded{flt(0), flt(0), flt(0)};
+  assert(!load_bookmark(path.c_str(), 1, loaded));
+  assert(save_bookmark(path.c_str(), 1, first));
+  assert(save_bookmark(path.c_str(), 3, second));
+  assert(load_bookmark(path.c_str(), 1, loaded) &&
+         loaded.center_x == first.center_x);
+  assert(load_bookmark(path.c_str(), 3, loaded) &&
+         loaded.center_x == second.center_x);
+
+  // Cut the file inside the position of slot 3, before the flags of the six
+  // empty slots after it
+  const auto size = std::filesystem::file_size(path) - 10;
+  std::filesystem::resize_file(path, size);
+  assert(load_bookmark(path.c_str(), 1, loaded));
+  assert(!load_bookmark(path.c_str(), 3, loaded));
+  assert(!save_bookmark(path.c_str(), 5, first));
+  assert(std::filesystem::file_size(path) == size);
+  assert(!std::filesystem::exists(path + ".tmp"));
+  std::filesystem::remove(path);
+}
+
+/**
+ * iter_de() should iterate exactly like iter(), and estimate the distance
+ * within a factor of four close to the set. Left of -2 on the real axis the
+ * distance to the set is known.
+ */
+template <typename FLT>
+void test_distance_estimate() {
+  auto plain = iter(FLT(-0.75), FLT(0.1));
+  auto de = iter_de(FLT(-0.75), FLT(0.1));
+  assert_flt(de.iterations == plain.iterations);
+  assert_flt(de.x == plain.x && de.y == plain.y);
+
+  auto interior = iter_de(FLT(-0.1), FLT(0.1));
+  assert_flt(interior.iterations == LIMIT && interior.distance == 0.0);
+
+  for (double distance : {1e-3, 1e-5}) {
+    auto outside = iter_de(FLT(-2.0 - distance), FLT(0.0));
+    assert_flt(outside.distance > distance &&
+               outside.distance < 4.01 * distance);
+  }
+}
+
+/**
+ * Continuing a point that reached a lower limit should give exactly the
+ * result of iterating it with the higher limit from the start.
+ */
+template <typename FLT>
+void test_iter_continue() {
+  // Escapes after 23, 32 and 314 iterations, and inside a period 3 bulb
+  const double points[][2] = {
+      {-0.1, 0.9}, {-0.75, 0.1}, {-0.75, 0.01}, {-0.122, 0.745}};
+  for (const auto &p : points) {
+    const FLT xc(p[0]), yc(p[1]);
+    auto full = iter(xc, yc, LIMIT);
+    iter_state<FLT> state;
+    auto result = iter(xc, yc, 8u, &state);
+    for (unsigned int limit = 8; result.iterations == limit && limit < LIMIT;) {
+      limit = std::min<unsigned int>(limit * 4, LIMIT);
+      iter_state<FLT> next;
+      result = iter_continue(xc, yc, state, limit, &next);
+      state = next;
+    }
+    assert_flt(result.iterations == full.iterations);
+    assert_flt(result.x == full.x && result.y == full.y);
+  }
+
+  iter_state<FLT> inside{FLT(1), FLT(1), 1, false};
+  iter(FLT(-0.1), FLT(0.1), 8u, &inside);
+  assert_flt(inside.inside);
+}
+
+/**
+ * Checking escape once per block of iterations must give exactly the
+ * result of checking every iteration, also for points escaping at once,
+ * and for the state of points that reach the limit.
+ */
+template <typename FLT>
+void test_escape_block() {
+  int differing = 0;
+  for (double y = -1.5; y <= 1.5; y += 1.0 / 16) {
+    for (double x = -2.5; x <= 1.0; x += 1.0 / 16) {
+      for (unsigned int limit : {5u, 100u, unsigned(LIMIT)}) {
+        iter_state<FLT> blocked_state, state;
+        auto blocked = iter(FLT(x), FLT(y), limit, &blocked_state);
+        auto result = iter<FLT, 1>(FLT(x), FLT(y), limit, &state);
+        if (blocked.iterations != result.iterations ||
+            blocked.x != result.x || blocked.y != result.y ||
+            blocked_state.x != state.x || blocked_state.y != state.y ||
+            blocked_state.iterations != state.iterations)
+          ++differing;
+      }
+    }
+  }
+  assert_flt(escape_block<FLT>::size > 1 && differing == 0);
+}
+
+/**
+ * The cycle of a point inside a period 3 bulb should be found from its
+ * orbit, and recognize its neighbor inside the same bulb but not a point
+ * outside.
+ */
+template <typename FLT>
+void test_interior_cycle() {
+  iter_state<FLT> state;
+  auto result = iter(FLT(-0.122), FLT(0.745), LIMIT, &state);
+  assert_flt(result.iterations == LIMIT);
+  interior_cycle<FLT> cycle;
+  assert_flt(find_cycle(FLT(-0.122), FLT(0.745), state, cycle));
+  assert_flt(cycle.period == 3);
+
+  interior_cycle<FLT> neighbor = cycle;
+  assert_flt(isinside(FLT(-0.121), FLT(0.746), neighbor));
+  assert_flt(neighbor.period == 3);
+  interior_cycle<FLT> outside = cycle;
+  assert_flt(!isinside(FLT(-0.1), FLT(0.9), outside));
+}
+
+/**
+ * The minibrots of period 3 on the real axis and of period 4 in the
+ * antenna of the period 3 bulb. A minibrot is a copy of the set, so its
+ * scale should map the period 2 bulb of the set onto the period 8 bulb of
+ * the minibrot of period 4.
+ */
+template <typename FLT>
+void test_nucleus() {
+  minibrot<FLT> m;
+  assert_flt(find_minibrot(FLT(-1.75), FLT(0), FLT(0.01), 0, m));
+  assert_flt(m.period == 3);
+  assert_flt(std::abs(get_double(m.x) + 1.754877666246693) < 1e-14);
+  assert_flt(m.y == FLT(0));
+  // The orbit of the nucleus returns to 0 at full precision
+  FLT zx{0}, zy{0};
+  for (unsigned int i = 0; i < m.period; ++i) {
+    const FLT nzx = zx * zx - zy * zy + m.x;
+    zy = FLT(2.0) * zx * zy + m.y;
+    zx = nzx;
+  }
+  assert_flt(zx * zx + zy * zy <
+             FLT(1e6) * std::numeric_limits<FLT>::epsilon() *
+                 std::numeric_limits<FLT>::epsilon());
+  const double size = get_double(minibrot_size(m));
+  assert_flt(size > 0.01 && size < 0.03);
+
+  // A period that is a multiple of the period of the nucleus found
+  minibrot<FLT> multiple;
+  assert_flt(find_minibrot(FLT(-1.75), FLT(0), FLT(0.01), 6, multiple) &&
+             multiple.period == 3);
+
+  minibrot<FLT> antenna;
+  assert_flt(find_minibrot(FLT(-0.156), FLT(1.032), FLT(0.01), 0, antenna));
+  assert_flt(antenna.period == 4);
+  const FLT bulb_x = antenna.x - antenna.scale_x;
+  const FLT bulb_y = antenna.y - antenna.scale_y;
+  iter_state<FLT> state;
+  interior_cycle<FLT> cycle;
+  assert_flt(iter(bulb_x, bulb_y, LIMIT, &state).iterations == LIMIT);
+  assert_flt(find_cycle(bulb_x, bulb_y, state, cycle) &&
+             cycle.period % 8 == 0);
+
+  FLT x, y, view_size;
+  frame_minibrot(antenna, x, y, view_size);
+  assert_flt(get_double(view_size) > 2.0 * get_double(minibrot_size(antenna)));
+}
+
 /**
  * Should be possible to stream a float type in and out without losing
  * information.
@@ -136,6 +409,19 @@ void test_format() {
   }
 }
 
+/// Only whole numbers are accepted, as sent by clients of the tile server
+template <typename FLT>
+void test_parse_number() {
+  FLT value;
+  assert(parse_number("-0.75", value));
+  assert_flt(value == FLT(-0.75));
+  assert(parse_number(" 1e-3 ", value));
+  assert(!parse_number("", value));
+  assert(!parse_number("x", value));
+  assert(!parse_number("0.5x", value));
+  assert(!parse_number("0.5 0.5", value));
+}
+
 /**
  * Converting to a higher precision float point type and back should retain the
  * original value.
@@ -218,8 +504,52 @@ int main(int argc, char** argv) {
   test_format<mpfrfloat<256, MPFR_RNDD>>();
   test_format<doubledouble<__float80>>();
   test_format<doubledouble<__float128>>();
+  test_format<floatexp>();
+
+  test_parse_number<double>();
+  test_parse_number<__float128>();
+  test_parse_number<doubledouble<double>>();
+  test_parse_number<gmpfloat<256>>();
+  test_parse_number<mpfrfloat<256, MPFR_RNDN>>();
 
   test_gmpfloat();
+  test_floatexp();
+
+  test_distance_estimate<double>();
+  test_distance_estimate<doubledouble<double>>();
+  test_distance_estimate<gmpfloat<128>>();
+
+  test_iter_continue<double>();
+  test_iter_continue<doubledouble<double>>();
+  test_iter_continue<gmpfloat<128>>();
+
+  test_escape_block<float>();
+  test_escape_block<double>();
+  test_escape_block<__float128>();
+  test_escape_block<doubledouble<float>>();
+  test_escape_block<doubledouble<double>>();
+
+  test_interior_cycle<float>();
+  test_interior_cycle<double>();
+  test_interior_cycle<doubledouble<double>>();
+  test_interior_cycle<gmpfloat<128>>();
+
+  test_nucleus<double>();
+  test_nucleus<__float128>();
+  test_nucleus<gmpfloat<256>>();
+
+  test_exact<double>();
+  test_exact<long double>();
+  test_exact<__float128>();
+  test_exact<gmpfloat<128>>();
+  test_exact<gmpfloat<256>>();
+  test_exact<doubledouble<float>>();
+  test_exact<doubledouble<double>>();
+  test_exact<doubledouble<long double>>();
+  test_exact<doubledouble<__float128>>();
+  test_exact_gap();
+  test_bookmark();
+  test_bookmark_file();
 
   test_float_type<float>();
   test_float_type<double>();
@@ -231,6 +561,7 @@ int main(int argc, char** argv) {
   test_float_type<doubledouble<__float80>>();
   test_float_type<__float128>();
   test_float_type<doubledouble<__float128>>();
+  test_float_type<floatexp>();
   test_float_type<gmpfloat<128>>();
   test_float_type<gmpfloat<256>>();
   test_float_type<mpfrfloat<128, MPFR_RNDD>>();
@@ -240,7 +571,7 @@ int main(int argc, char** argv) {
 
   std::cout << assert_count << " assertions, " << assert_failures << " failures"
             << std::endl;
-  return 0;
+  return assert_failures == 0 ? 0 : 1;
 
   // printf("float %e\n", std::numeric_limits<float>::epsilon());
   // printf("double %e\n", std::numeric_limits<double>::epsilon());